@@ -135,6 +135,23 @@
 #include "_PS2KeyCode.h"
 #include "_PS2KeyTable.h"
 
+// Time stamps for the receive glitch timeout of 250 ms. On AVR these are the
+// lower 16 bits of the timer 0 overflow count the core keeps for millis( )
+// (see wiring.c), one tick per 1.024 ms at 16 MHz. Reading, comparing and
+// storing those takes about 18 cycles, against 48 with millis( ), which saves
+// and restores SREG and returns 32 bits. Only the low byte would wrap after
+// 262 ms, too close to the timeout
+#if defined( PS2_TIMER0_OVF )
+extern volatile unsigned long timer0_overflow_count;
+typedef uint16_t ps2_stamp_t;
+#define PS2_STAMP( )    ( *(volatile uint16_t *)&timer0_overflow_count )
+#define PS2_TIMEOUT     ( ( 250UL * ( F_CPU / 1000UL ) ) / ( 64UL * 256UL ) )
+#else
+typedef uint32_t ps2_stamp_t;
+#define PS2_STAMP( )    millis( )
+#define PS2_TIMEOUT     250
+#endif
+
 
 // Private function declarations
 void send_bit( void );
@@ -198,6 +215,9 @@ uint8_t _mode = 0;            // Mode for output buffer contains
 // Arduino settings for pins and interrupts Needed to send data
 uint8_t PS2_DataPin;
 uint8_t PS2_IrqPin;
+#if defined( PS2_FAST_DATA_PIN )
+uint8_t PS2_FastData;         // Data pin is PS2_FAST_DATA_PIN
+#endif
 
 // Key decoding variables
 uint8_t PS2_led_lock = 0;     // LED and Lock status
@@ -217,19 +237,25 @@ if( _ps2mode & _TX_MODE )
   send_bit( );
 else
   {
-  static uint32_t prev_ms = 0;
-  uint32_t now_ms;
+  static ps2_stamp_t prev_stamp = 0;
+  ps2_stamp_t now_stamp;
   uint8_t val, ret;
 
-  val = digitalRead( PS2_DataPin );
+  PS2_ISR_ENTER( );
+#if defined( PS2_FAST_DATA_PIN )
+  if( PS2_FastData )
+    val = ( PS2_FAST_DATA_PORT >> PS2_FAST_DATA_BIT ) & 1;
+  else
+#endif
+    val = digitalRead( PS2_DataPin );
   /* timeout catch for glitches reset everything */
-  now_ms = millis( );
-  if( now_ms - prev_ms > 250 )
+  now_stamp = PS2_STAMP( );
+  if( ps2_stamp_t( now_stamp - prev_stamp ) > PS2_TIMEOUT )
     {
     _bitcount = 0;
     _shiftdata = 0;
     }
-  prev_ms = now_ms;
+  prev_stamp = now_stamp;
   _bitcount++;             // Now point to next bit
   switch( _bitcount )
     {
@@ -300,6 +326,7 @@ else
     default: // in case of weird error and end of byte reception re-sync
             _bitcount = 0;
     }
+  PS2_ISR_EXIT( );
   }
 }
 
@@ -998,6 +1025,9 @@ ps2_reset( );
 
 PS2_DataPin = data_pin;
 PS2_IrqPin = irq_pin;
+#if defined( PS2_FAST_DATA_PIN )
+PS2_FastData = ( data_pin == PS2_FAST_DATA_PIN );
+#endif
 
 // initialize the pins
 pininput( PS2_IrqPin );            /* Setup Clock pin */
@@ -143,6 +143,31 @@
 #define PS2_SUPPORTED           1
 #define PS2_REQUIRES_PROGMEM    1
 #define PS2_CLEAR_PENDING_IRQ   1
+#define PS2_TIMER0_OVF          1
+#endif
+// AVR fast path for the receive interrupt: when begin( ) is given
+// PS2_FAST_DATA_PIN as data pin, the interrupt reads the data line straight
+// from the port input register instead of calling digitalRead( ), about 9
+// instead of 56 cycles. Pin 4 is PD4 on ATmega328P/168 boards (Uno, Nano,
+// Pro Mini)
+#if defined( ARDUINO_ARCH_AVR ) && \
+    ( defined( __AVR_ATmega328P__ ) || defined( __AVR_ATmega168__ ) )
+#define PS2_FAST_DATA_PIN       4
+#define PS2_FAST_DATA_PORT      PIND
+#define PS2_FAST_DATA_BIT       4
+#endif
+// Hooks for measuring the receive interrupt, e.g. raise a spare pin on entry
+// and lower it on exit, then time the pulse with a logic analyser or scope
+//   #define PS2_ISR_ENTER( )    PORTD |= _BV( 2 )
+//   #define PS2_ISR_EXIT( )     PORTD &= ~_BV( 2 )
+// The pin needs to be set as output (DDRD |= _BV( 2 )). On spectratur, D2 is
+// only spare with frame sync turned off (FRAME_SYNC false), and A5 (PC5)
+// only with an MT8808; on MT8812/16 it's address line AX3, and all other
+// pins are always in use
+// Empty by default
+#if !defined( PS2_ISR_ENTER )
+#define PS2_ISR_ENTER( )
+#define PS2_ISR_EXIT( )
 #endif
 // SAM
 #if defined( ARDUINO_ARCH_SAM )
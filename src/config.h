@@ -23,6 +23,13 @@
 #define DEBUG false
 
 
+// Set the switch chip that is fitted: `MT8808`, `MT8812`, or `MT8816`. Address
+// and strobe handling are generated for this chip at compile time. Only the
+// MT8812/16 need the additional AX3 connection on A5.
+//
+#define MT88XX_CHIP MT8808
+
+
 // Set whether to use an external keyboard (PS/2 or PS/2 capable USB keyboard).
 //
 #define EXTERNAL_KBD true
@@ -40,6 +47,109 @@
 #define JOYSTICK true
 
 
+// Debounce time in milliseconds for the joystick lines, at most 255. The first
+// edge on a line is taken right away, and further edges on that line are
+// ignored for this long, see joystick.h.
+//
+#define JOYSTICK_DEBOUNCE 10
+
+
+// Autofire rate in Hz and duty cycle in percent. Autofire is toggled with F4,
+// either on the external keyboard or via the serial port. On and off times are
+// never shorter than the target's minimum hold and gap times.
+//
+#define JOYSTICK_AUTOFIRE_RATE 10
+#define JOYSTICK_AUTOFIRE_DUTY 50
+
+
+// Number of joystick profiles, at most 8. Each one has its own key map, set
+// with F1, and a name, set via the serial port. F5 switches to the next
+// profile. All profiles are kept in EEPROM, see profiles.h.
+//
+#define JOYSTICK_PROFILES 4
+
+
+// Set whether a paddle, i.e. a potentiometer wired as voltage divider, is
+// connected to A6. Turning it left or right of center presses the joystick's
+// left or right key, pulsed with a duty cycle growing with the deflection.
+// `PADDLE_PERIOD` is the pulse period in milliseconds.
+//
+#define PADDLE false
+#define PADDLE_PERIOD 100
+
+
+// Set whether a frame sync signal from the target is connected to D2, e.g. the
+// frame interrupt line (/INT on the Spectrum). Each falling edge is taken as
+// the start of a keyboard scan. Changes to the switch matrix are then only
+// committed in between scans, `FRAME_SYNC_DELAY` ms after an edge, and the
+// minimum hold & gap times of the target's timing profile are raised to half
+// the measured scan period if shorter. Without a signal, the timing profile
+// is used as usual.
+//
+#define FRAME_SYNC false
+#define FRAME_SYNC_DELAY 2
+
+
+// The timeout in milliseconds for receiving a complete frame via the serial
+// port. When the remainder of a frame does not arrive in time, what has been
+// received so far is discarded. This lets the adapter get back in step with
+// the sender after a lost byte.
+//
+#define SERIAL_FRAME_TIMEOUT 20
+
+
+// Once the host has switched to protocol v2, only v2 frames are accepted, so
+// that a stray byte can't be mistaken for the start of a v1 frame. The v1
+// commands are accepted again after the serial line has been quiet for this
+// many milliseconds, so a v1 host can take over. Needs to be longer than the
+// interval at which a v2 host sends heartbeats (500 ms for `kev`).
+//
+#define SERIAL_V1_FALLBACK_TIMEOUT 1000
+
+
+// Number of slots in the queue through which all input sources pass their key
+// events to the target keyboard. Needs to be a power of 2, and large enough to
+// hold a full serial frame. Each slot takes 4 bytes of RAM.
+//
+#define EVENT_QUEUE_SIZE 64
+
+
+// Size in bytes of the buffer for text received via the serial port, which is
+// then typed on the target. The host is granted credits for the free space in
+// this buffer, so it never sends more than fits. At most 128, since credits
+// are counted modulo 256, see textkbd.h.
+//
+#define TEXT_BUFFER_SIZE 64
+
+
+// Number of records in each of the two banks of the movie buffer. The host is
+// granted credits for a bank whenever it has been played. Each record takes
+// 3 bytes plus one byte per AX line of the switch chip.
+//
+#define MOVIE_BANK_SIZE 8
+
+
+// Number of timed key events that can be pending, i.e. received but not yet
+// due. Each takes 5 bytes of RAM. The host needs to keep the time it sends
+// events ahead short enough to not exceed this.
+//
+#define SCHEDULE_SIZE 16
+
+
+// Maximum time in ms a key from each source may be held, after which it is
+// released automatically, 0 for no limit. At most 65000. All are off by
+// default, since games may hold keys for a long time, and the external
+// keyboard doesn't repeat keys, so a long hold looks just like a lost break
+// code. Keys from the host are released when the host stops sending
+// heartbeats for longer than `HOST_HEARTBEAT_TIMEOUT` ms, see watchdog.h.
+//
+#define WATCHDOG_MAX_HOLD_SERIAL 0
+#define WATCHDOG_MAX_HOLD_PS2 0
+#define WATCHDOG_MAX_HOLD_JOYSTICK 0
+#define WATCHDOG_MAX_HOLD_MOVIE 0
+#define HOST_HEARTBEAT_TIMEOUT 2000
+
+
 // macro for special keys (combos & macros)
 //
 #define SK( k ) K_SPECIAL | k
@@ -51,13 +161,27 @@ static const uint8_t K_MASK_AX = B00001111; // mask for AX address bits
 static const uint8_t K_MASK_AY = B01110000; // mask for AY address bits
 
 
-// delay in ms after pressing a key within a macro
-//
-#define MACRO_DELAY_PRESS 100
+// entry in a target's specials table; see targets/sinclair_spectrum.h
+struct Special {
+    uint8_t id;
+    const uint8_t *keys;
+};
 
-// delay in ms after releasing a key within a macro
-//
-#define MACRO_DELAY_RELEASE 200
+// entry in a target's text map; see targets/sinclair_spectrum.h
+struct TextKey {
+    uint8_t modifier;
+    uint8_t key;
+};
+
+// timing profile of a target; see targets/sinclair_spectrum.h
+struct TimingProfile {
+    uint8_t minHold;      // minimum time in ms a switch stays closed
+    uint8_t minGap;       // minimum time in ms a switch stays open
+    uint8_t repeatGap;    // ms a typed key stays released before pressed again
+    uint8_t comboDelay;   // ms between modifier and other keys of a combo
+    uint8_t toggleSettle; // ms after a toggle before handling the next key
+    uint16_t framePeriod; // target's frame period in µs
+};
 
 
 // Include the header file with all the necessary definitions for your target
@@ -0,0 +1,110 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <util/atomic.h>
+
+#include "eventqueue.h"
+
+//
+template <uint8_t SIZE>
+EventQueue<SIZE>::EventQueue() : head(0), tail(0), overflowCount(0) {}
+
+// Appends an event, producer side only. Returns false if the queue is full.
+template <uint8_t SIZE>
+bool EventQueue<SIZE>::push(EventSource s, uint8_t key, KeyAction a,
+    bool more) {
+
+    KeyEvent e;
+    e.source = s;
+    e.action = a;
+    e.more = more;
+    e.key = key;
+    e.time = millis();
+    return push(e);
+}
+
+// Appends a complete event as is, e.g. one taken from another queue, keeping
+// its time stamp.
+template <uint8_t SIZE>
+bool EventQueue<SIZE>::push(const KeyEvent &e) {
+
+    uint8_t h = head;
+    uint8_t next = (h + 1) & MASK;
+
+    if (next == tail) {
+        overflowCount++;
+        return false;
+    }
+
+    events[h] = e;
+
+    // event needs to be complete before consumer can see it
+    MEMORY_BARRIER();
+    head = next;
+    return true;
+}
+
+// Removes the oldest event, consumer side only. Returns false if the queue is
+// empty.
+template <uint8_t SIZE>
+bool EventQueue<SIZE>::pop(KeyEvent &e) {
+
+    uint8_t t = tail;
+
+    if (t == head) {
+        return false;
+    }
+
+    MEMORY_BARRIER();
+    e = events[t];
+    MEMORY_BARRIER();
+    tail = (t + 1) & MASK;
+    return true;
+}
+
+// number of queued events
+template <uint8_t SIZE>
+uint8_t EventQueue<SIZE>::count() {
+    return (head - tail) & MASK;
+}
+
+// number of events that can still be queued
+template <uint8_t SIZE>
+uint8_t EventQueue<SIZE>::available() {
+    return MASK - count();
+}
+
+// number of events dropped so far because the queue was full
+template <uint8_t SIZE>
+uint16_t EventQueue<SIZE>::overflows() {
+    uint16_t ret;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ret = overflowCount;
+    }
+    return ret;
+}
+
+// Drops all queued events. Consumer side only, so this only moves `tail`.
+template <uint8_t SIZE>
+void EventQueue<SIZE>::clear() {
+    tail = head;
+}
+
+// both sizes in use; instantiating the same size twice would be an error
+template class EventQueue<EVENT_QUEUE_SIZE>;
+#if JOYSTICK_QUEUE_SIZE != EVENT_QUEUE_SIZE
+template class EventQueue<JOYSTICK_QUEUE_SIZE>;
+#endif
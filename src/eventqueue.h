@@ -0,0 +1,90 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef EVENTQUEUE_h
+#define EVENTQUEUE_h
+
+#include <Arduino.h>
+
+#include "config.h"
+
+// keeps the compiler from moving memory accesses across this point
+#define MEMORY_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+
+//
+enum EventSource {
+    SOURCE_SERIAL,
+    SOURCE_PS2,
+    SOURCE_JOYSTICK,
+    SOURCE_MOVIE,
+    SOURCE_PADDLE
+};
+
+/*
+    A key event as passed from an input source to the target keyboard. `more`
+    is set when further events belonging to the same change follow, e.g. for
+    joystick diagonals, so the consumer only commits the matrix after the last
+    one.
+ */
+struct KeyEvent {
+    uint8_t source : 3; // `EventSource`
+    uint8_t action : 2; // `KeyAction`
+    uint8_t more   : 1;
+    uint8_t key;
+    uint16_t time;      // lower 16 bits of `millis` when event was queued
+};
+
+/*
+    Fixed size single producer, single consumer ring of key events. It's lock
+    free: `head` is only written by the producer, `tail` only by the consumer,
+    and both are single bytes, so reading them is atomic. A producer may
+    therefore run in an ISR, but each ring must only have one producer context.
+    When the ring is full, the event is dropped and counted as overflow.
+    `SIZE` needs to be a power of 2, and one slot is always kept free.
+ */
+template <uint8_t SIZE>
+class EventQueue {
+
+    static_assert(SIZE >= 2 && SIZE <= 128 && (SIZE & (SIZE - 1)) == 0,
+        "event queue size needs to be a power of 2 between 2 and 128");
+
+private:
+    static const uint8_t MASK = SIZE - 1;
+
+    KeyEvent events[SIZE];
+    volatile uint8_t head;
+    volatile uint8_t tail;
+    volatile uint16_t overflowCount;
+
+public:
+    EventQueue();
+    bool push(EventSource s, uint8_t key, KeyAction a, bool more = false);
+    bool push(const KeyEvent &e);
+    bool pop(KeyEvent &e);
+    uint8_t count();
+    uint8_t available();
+    uint16_t overflows();
+    void clear();
+};
+
+// the ring between joystick ISR and main loop, see joystick.h; a macro, so
+// eventqueue.cpp can compare it with `EVENT_QUEUE_SIZE` when instantiating
+#define JOYSTICK_QUEUE_SIZE 16
+
+// the queue connecting all input sources in the main loop to the target
+typedef EventQueue<EVENT_QUEUE_SIZE> KeyEventQueue;
+
+#endif
@@ -17,8 +17,7 @@
 #include "externalkbd.h"
 
 //
-ExternalKbd::ExternalKbd(uint8_t dataPin, uint8_t irqPin) :
-    map{MAP_INPUT_TO_TARGET, array_len(MAP_INPUT_TO_TARGET)} {
+ExternalKbd::ExternalKbd(uint8_t dataPin, uint8_t irqPin) {
     ps2.begin(dataPin, irqPin);
 }
 
@@ -49,17 +48,20 @@ void ExternalKbd::reset() {
     DPRINTLN("not attached");
 }
 
-//
-void ExternalKbd::process(TargetKbd *kbd, Joystick *joy) {
+// Queues the next key event from the keyboard, if any. While the joystick is
+// capturing keys for its map, key events go there instead. Returns whether
+// Esc asked for resetting the adapter, which the caller needs to do, since it
+// affects all sources and the target keyboard.
+bool ExternalKbd::process(KeyEventQueue *q, Joystick *joy) {
 
     if (!ps2.available()) {
-        return;
+        return false;
     }
 
     uint16_t c = ps2.read();
 
     if (c == 0) {
-        return;
+        return false;
     }
 
     uint8_t code = c & 0xff;
@@ -69,22 +71,26 @@ void ExternalKbd::process(TargetKbd *kbd, Joystick *joy) {
     if ((c & PS2_BREAK) != 0) {
         switch (code) {
             case 27: // reset
-                reset();
-                if (kbd != NULL) {
-                    kbd->reset();
+                return true;
+            case 97: // joystick setup
+                if (joy != NULL) {
+                    joy->startCapture();
                 }
+                return false;
+            case 100: // autofire (F4)
                 if (joy != NULL) {
-                    joy->reset();
+                    joy->toggleAutofire();
                 }
-                return;
-            case 97: // joystick setup
-                setJoystickMap(joy);
-                return;
+                return false;
+            case 101: // next joystick profile (F5)
+                if (joy != NULL) {
+                    joy->nextProfile();
+                }
+                return false;
         }
     }
 
-    code = toInputCode(code);
-    uint8_t key = map.translate(code);
+    uint8_t key = toTargetKey(code);
     KeyAction a;
 
     if ((c & PS2_BREAK) != 0) {
@@ -96,45 +102,18 @@ void ExternalKbd::process(TargetKbd *kbd, Joystick *joy) {
     DPRINTLN("[PS/2] control: " + String(c >> 8) + ", action: " + String(a) +
         ", code: " + String(code) + ", key: " + String(key));
 
-    kbd->handleKey(key, a);
-}
-
-//
-uint8_t ExternalKbd::toInputCode(uint8_t ps2Code) {
-    if (ps2Code < array_len(MAP_PS2_TO_INPUT)) {
-        return MAP_PS2_TO_INPUT[ps2Code];
+    if (joy == NULL || !joy->capture(key, a)) {
+        q->push(SOURCE_PS2, key, a);
     }
-    return KEY_RESERVED;
-}
-
-//
-void ExternalKbd::setJoystickMap(Joystick *j) {
 
-    if (j == NULL) {
-        return;
-    }
-
-    DPRINTLN("[PS/2] setting joystick map");
-    uint8_t m[JOYSTICK_ACTIONS];
-
-    for (int ix = 0; ix < JOYSTICK_ACTIONS; ) {
-
-        if (ps2.available()) {
-
-            uint16_t c = ps2.read();
-
-            if ((c & PS2_BREAK) != 0) {
-                uint8_t code = toInputCode(c & 0xff);
-                uint8_t key = map.translate(code);
-                DPRINTLN("[PS/2] joystick setup " + String(key));
-                m[ix] = key;
-                ix++;
-            }
+    return false;
+}
 
-        } else {
-            delay(100);
-        }
+// translates PS/2 code to target key with a single lookup in the composed
+// table
+uint8_t ExternalKbd::toTargetKey(uint8_t ps2Code) {
+    if (ps2Code < array_len(MAP_PS2_TO_INPUT)) {
+        return pgm_read_byte(MAP_PS2_TO_TARGET::table + ps2Code);
     }
-
-    j->setMap(m);
+    return NA;
 }
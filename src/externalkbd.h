@@ -22,8 +22,9 @@
 #include "_PS2KeyAdvanced.h"
 
 #include "config.h"
+#include "eventqueue.h"
 #include "joystick.h"
-#include "keymap.h"
+#include "tables.h"
 #include "targetkbd.h"
 #include "input_keycodes.h"
 
@@ -32,9 +33,9 @@
     to our input key codes. It's somewhat redundant, since the library already
     does a translation, but it does not seem trivial to modify its translation
     table without hurting functionality. But it's a small table and only a
-    single array lookup, so not much of an overhead.
+    single array lookup, so not much of an overhead. The table resides in flash.
  */
-static const uint8_t MAP_PS2_TO_INPUT[] = {
+static constexpr uint8_t MAP_PS2_TO_INPUT[] PROGMEM = {
     KEY_RESERVED,
     KEY_NUMLOCK,    // PS2_KEY_NUM         0x01
     KEY_SCROLLLOCK, // PS2_KEY_SCROLL      0x02
@@ -146,21 +147,45 @@ static const uint8_t MAP_PS2_TO_INPUT[] = {
     KEY_F12         // PS2_KEY_F12         0X6C
 };
 
+/*
+    For the hot path in `ExternalKbd::process`, above table and the target's
+    `MAP_INPUT_TO_TARGET` are composed at compile time into a single table
+    that translates PS/2 codes directly into target keys. The table resides
+    in flash.
+ */
+constexpr uint8_t ps2ToTarget(uint8_t ps2Code) {
+    return MAP_PS2_TO_INPUT[ps2Code] < array_len(MAP_INPUT_TO_TARGET) ?
+        MAP_INPUT_TO_TARGET[MAP_PS2_TO_INPUT[ps2Code]] : NA;
+}
+
+template <typename T> struct Ps2Table;
+
+template <uint16_t... I>
+struct Ps2Table<Indices<I...> > {
+    static const uint8_t table[sizeof...(I)];
+};
+
+template <uint16_t... I>
+const uint8_t Ps2Table<Indices<I...> >::table[sizeof...(I)] PROGMEM = {
+    ps2ToTarget(I)...
+};
+
+typedef Ps2Table<MakeIndices<array_len(MAP_PS2_TO_INPUT)>::type>
+    MAP_PS2_TO_TARGET;
+
 //
 class ExternalKbd {
 
 private:
     PS2KeyAdvanced ps2;
-    KeyMap map;
 
     void config();
-    uint8_t toInputCode(uint8_t ps2Code);
-    void setJoystickMap(Joystick *joy);
+    uint8_t toTargetKey(uint8_t ps2Code);
 
 public:
     ExternalKbd(uint8_t dataPin, uint8_t irqPin);
     void reset();
-    void process(TargetKbd *kbd, Joystick *joy);
+    bool process(KeyEventQueue *q, Joystick *joy);
 };
 
 #endif
@@ -0,0 +1,97 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <util/atomic.h>
+
+#include "framesync.h"
+
+// written by the ISR only
+static volatile uint16_t edges = 0;
+static volatile unsigned long lastEdge = 0; // `micros` time stamp
+static volatile uint16_t avgPeriod = 0;     // in µs
+
+// Time stamps each edge and keeps a moving average of the period, which
+// smooths out interrupt latency. Periods longer than 65 ms are discarded,
+// e.g. the first one after the target was switched on. This is attached to
+// INT0 via `attachInterrupt`, since the Arduino core already defines the ISRs
+// for external interrupts, which the PS/2 library uses for INT1.
+static void onEdge() {
+    unsigned long now = micros();
+    unsigned long p = now - lastEdge;
+    lastEdge = now;
+    edges++;
+    if (p <= 0xffff) {
+        avgPeriod = avgPeriod == 0 ?
+            p : avgPeriod + ((int32_t)p - (int32_t)avgPeriod) / 8;
+    }
+}
+
+//
+FrameSync::FrameSync() : seen(0) {}
+
+// enables INT0 on falling edge
+void FrameSync::begin() {
+    DPRINTLN("[SYNC] enabling frame sync on D2");
+    attachInterrupt(digitalPinToInterrupt(FRAME_SYNC_PIN), onEdge, FALLING);
+}
+
+// whether the sync signal is present and its period has been measured
+bool FrameSync::isLocked() {
+    unsigned long last;
+    uint16_t p;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        last = lastEdge;
+        p = avgPeriod;
+    }
+    return p > 0 && micros() - last < FRAME_SYNC_TIMEOUT * 1000UL;
+}
+
+// Returns true once per scan, as soon as `FRAME_SYNC_DELAY` ms have passed
+// since the edge that started it, i.e. when the target is done scanning.
+bool FrameSync::scanDone() {
+
+    uint16_t e;
+    unsigned long last;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        e = edges;
+        last = lastEdge;
+    }
+
+    if (e == seen || micros() - last < FRAME_SYNC_DELAY * 1000UL) {
+        return false;
+    }
+
+    seen = e;
+    return true;
+}
+
+// number of edges seen so far, i.e. a frame counter
+uint16_t FrameSync::frames() {
+    uint16_t e;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        e = edges;
+    }
+    return e;
+}
+
+// measured scan period in µs, 0 if not known yet
+uint16_t FrameSync::period() {
+    uint16_t p;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        p = avgPeriod;
+    }
+    return p;
+}
@@ -0,0 +1,51 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef FRAMESYNC_h
+#define FRAMESYNC_h
+
+#include <Arduino.h>
+
+#include "config.h"
+
+static const uint8_t FRAME_SYNC_PIN = 2;
+
+// without an edge for this long in ms, we consider the sync signal lost
+static const uint8_t FRAME_SYNC_TIMEOUT = 100;
+
+/*
+    Frame sync input on D2 (INT0). When `FRAME_SYNC` is enabled in config.h,
+    D2 is connected to a signal of the target that marks its keyboard scans,
+    e.g. the frame interrupt. Each falling edge is time stamped in the ISR,
+    from which we derive the target's scan period. `scanDone` then tells when
+    a scan has finished, so that matrix changes can be committed right in
+    between two scans.
+ */
+class FrameSync {
+
+private:
+    uint16_t seen;          // edge count when `scanDone` last returned true
+
+public:
+    FrameSync();
+    void begin();
+    bool isLocked();
+    bool scanDone();
+    uint16_t frames();
+    uint16_t period();
+};
+
+#endif
@@ -14,48 +14,290 @@
     limitations under the License.
 */
 
+#include <util/atomic.h>
+
 #include "joystick.h"
 
+// Autofire timing in ms. On and off times are at least the target's minimum
+// hold and gap times. Timer 1 runs at 250 kHz, so `startAutofire` and the ISR
+// convert them to `TICKS_PER_MS` ticks per ms.
+static const uint16_t AUTOFIRE_PERIOD = 1000 / JOYSTICK_AUTOFIRE_RATE;
+static const uint16_t AUTOFIRE_DUTY =
+    AUTOFIRE_PERIOD * JOYSTICK_AUTOFIRE_DUTY / 100;
+static const uint16_t AUTOFIRE_ON =
+    AUTOFIRE_DUTY > TIMING.minHold ? AUTOFIRE_DUTY : TIMING.minHold;
+static const uint16_t AUTOFIRE_OFF =
+    AUTOFIRE_PERIOD > AUTOFIRE_ON + TIMING.minGap ?
+        AUTOFIRE_PERIOD - AUTOFIRE_ON : TIMING.minGap;
+static const uint16_t TICKS_PER_MS = F_CPU / 64 / 1000;
+
+static_assert(AUTOFIRE_ON < 0xffff / TICKS_PER_MS
+    && AUTOFIRE_OFF < 0xffff / TICKS_PER_MS,
+    "autofire on & off times need to be below 262 ms");
+
+// Shared between ISRs and main loop. The ISRs can't interrupt each other, and
+// the main loop only touches these with interrupts disabled, so `changes` has
+// a single producer context at any time.
+static EventQueue<JOYSTICK_QUEUE_SIZE> changes;
+static volatile uint8_t accepted = JOYSTICK_ALL; // debounced line states
+static volatile uint8_t locked = 0;     // lines in lock-out
+static uint8_t lockedAt[JOYSTICK_ACTIONS]; // lower byte of `millis`
+static volatile bool autofire = false;
+static volatile bool firing = false;    // fire key pressed by autofire
+
+// Takes the current state of all lines that are not locked out, and locks out
+// the ones that changed. Returns the changed lines. Needs to run with
+// interrupts disabled.
+static uint8_t debounce() {
+
+    uint8_t now = millis();
+    uint8_t data = PINC & JOYSTICK_ALL;
+
+    for (uint8_t ix = 0, bit = 1; ix < JOYSTICK_ACTIONS; ix++, bit <<= 1) {
+        if ((locked & bit) != 0
+            && (uint8_t)(now - lockedAt[ix]) >= JOYSTICK_DEBOUNCE) {
+            locked &= ~bit;
+        }
+    }
+
+    uint8_t diff = (data ^ accepted) & ~locked;
+
+    for (uint8_t ix = 0, bit = 1; ix < JOYSTICK_ACTIONS; ix++, bit <<= 1) {
+        if ((diff & bit) != 0) {
+            lockedAt[ix] = now;
+        }
+    }
+
+    accepted ^= diff;
+    locked |= diff;
+    return diff;
+}
+
+// (re)starts timer 1 for `ms` ms until the next autofire step
+static void startAutofire(uint16_t ms) {
+    TCNT1 = 0;
+    OCR1A = ms * TICKS_PER_MS - 1;
+    TIFR1 = _BV(OCF1A);
+    TIMSK1 |= _BV(OCIE1A);
+}
+
 //
-Joystick::Joystick() {}
+static void stopAutofire() {
+    TIMSK1 &= ~_BV(OCIE1A);
+}
+
+// Queues an event for each line in `diff`, with the joystick action in place
+// of the key. All events but the last are marked as belonging together, so
+// diagonals are committed in one go. With autofire on, pressing the trigger
+// starts pulsing the fire key, and releasing it stops pulsing. Needs to run
+// with interrupts disabled.
+static void queueChanges(uint8_t diff) {
+
+    uint8_t data = accepted;
+
+    for (uint8_t ix = 0, bit = 1; diff != 0; ix++, bit <<= 1) {
+
+        if ((diff & bit) == 0) {
+            continue;
+        }
+        diff &= ~bit;
+        bool pressed = (data & bit) == 0;
+
+        if (bit == JOYSTICK_TRIGGER && autofire) {
+            if (pressed) {
+                firing = true;
+                startAutofire(AUTOFIRE_ON);
+            } else {
+                stopAutofire();
+                if (!firing) {
+                    continue; // fire key already released
+                }
+                firing = false;
+            }
+        }
+
+        changes.push(SOURCE_JOYSTICK, ix,
+            pressed ? PRESS_KEY : RELEASE_KEY, diff != 0);
+    }
+}
+
+// only the joystick lines trigger PCINT1, see `Joystick()`
+ISR(PCINT1_vect) {
+    queueChanges(debounce());
+}
+
+// autofire step: releases the fire key after its on time, and presses it
+// again after its off time, while the trigger is held
+ISR(TIMER1_COMPA_vect) {
+    if (firing) {
+        firing = false;
+        OCR1A = AUTOFIRE_OFF * TICKS_PER_MS - 1;
+    } else if ((accepted & JOYSTICK_TRIGGER) == 0) {
+        firing = true;
+        OCR1A = AUTOFIRE_ON * TICKS_PER_MS - 1;
+    } else {
+        stopAutofire();
+        return;
+    }
+    changes.push(SOURCE_JOYSTICK, JOYSTICK_ACTIONS - 1,
+        firing ? PRESS_KEY : RELEASE_KEY);
+}
+
+// Enables the pin change interrupt for the joystick lines, and sets up timer
+// 1 in CTC mode with prescaler 64 for autofire.
+Joystick::Joystick() : profiles(DEFAULT_MAP) {
+    captureIx = -1;
+    PCMSK1 = JOYSTICK_ALL;
+    PCIFR = _BV(PCIF1);
+    PCICR |= _BV(PCIE1);
+    TCCR1A = 0;
+    TCCR1B = _BV(WGM12) | _BV(CS11) | _BV(CS10);
+    TIMSK1 = 0;
+}
 
 //
 void Joystick::reset() {
     DPRINTLN("[ JOY] resetting");
-    setMap(DEFAULT_MAP);
-    state = JOYSTICK_ALL;
+    captureIx = -1;
+    setMap(profiles.getMap());
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        stopAutofire();
+        accepted = JOYSTICK_ALL;
+        locked = 0;
+        autofire = false;
+        firing = false;
+    }
+    changes.clear();
 }
 
-//
-void Joystick::process(uint8_t data, TargetKbd *kbd) {
+// Turns autofire on or off. When turned on while the trigger is held, the
+// fire key starts pulsing right away. When turned off while pulsing, the fire
+// key gets pressed for as long as the trigger is held.
+void Joystick::setAutofire(bool on) {
 
-    data = data & JOYSTICK_ALL;
-    uint8_t diff = data ^ state;
+    DPRINTLN("[ JOY] autofire: " + String(on));
 
-    if (diff == 0) {
-        return;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (on == autofire) {
+            return;
+        }
+        autofire = on;
+        if ((accepted & JOYSTICK_TRIGGER) != 0) {
+            return; // trigger not held
+        }
+        if (on) {
+            firing = true;
+            startAutofire(AUTOFIRE_ON);
+        } else {
+            stopAutofire();
+            if (!firing) {
+                changes.push(SOURCE_JOYSTICK, JOYSTICK_ACTIONS - 1,
+                    PRESS_KEY);
+            }
+            firing = false;
+        }
     }
+}
 
-    DPRINTLN("[ JOY] port data: " + String(data));
+//
+void Joystick::toggleAutofire() {
+    setAutofire(!autofire);
+}
 
-    uint8_t mask = 1;
+// Catches up on lines that settled in a different state during their lock-out,
+// which don't cause another interrupt. This is only needed while lines are
+// locked out, so interrupts stay enabled otherwise. Then moves all clean
+// transitions into the event queue, translated to target keys. Also keeps
+// writing profile changes to EEPROM.
+void Joystick::process(KeyEventQueue *q) {
 
-    for (uint8_t ix = 0; ix < JOYSTICK_ACTIONS; ix++) {
-        if ((diff & mask) != 0) {
-            kbd->handleKey(
-                map[ix], (data & mask) == 0 ? PRESS_KEY : RELEASE_KEY);
+    if (locked != 0) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            queueChanges(debounce());
         }
-        mask <<= 1;
     }
 
-    state = data;
+    KeyEvent e;
+
+    while (changes.pop(e)) {
+        DPRINTLN("[ JOY] action " + String(e.key) + ": " + String(e.action));
+        e.key = map[e.key];
+        q->push(e);
+    }
+
+    profiles.process();
+}
+
+// target key mapped to the joystick action with index `action`
+uint8_t Joystick::getKey(uint8_t action) {
+    return action < JOYSTICK_ACTIONS ? map[action] : NA;
 }
 
 //
-void Joystick::setMap(uint8_t m[JOYSTICK_ACTIONS]) {
+void Joystick::setMap(const uint8_t m[JOYSTICK_ACTIONS]) {
     for (uint8_t ix = 0; ix < JOYSTICK_ACTIONS; ix++) {
         DPRINTLN("[ JOY] mapping action " + String(ix) +
             " to key " + String(m[ix]));
         map[ix] = m[ix];
     }
 }
+
+// Starts capturing keys for a new map of the active profile. Starting again
+// while capturing begins anew.
+void Joystick::startCapture() {
+    DPRINTLN("[ JOY] capturing map for profile "
+        + String(profiles.current()));
+    captureIx = 0;
+}
+
+// Takes a key event while capturing; returns whether it was taken. Presses
+// are ignored, and keys not present on the target don't count. Once all
+// actions are mapped, the new map is stored in the active profile.
+bool Joystick::capture(uint8_t key, KeyAction a) {
+
+    if (captureIx < 0) {
+        return false;
+    }
+
+    if (a == RELEASE_KEY && key != NA) {
+        DPRINTLN("[ JOY] captured key " + String(key) + " for action "
+            + String(captureIx));
+        captured[captureIx++] = key;
+        if (captureIx == JOYSTICK_ACTIONS) {
+            captureIx = -1;
+            setMap(captured);
+            profiles.store(map);
+        }
+    }
+
+    return true;
+}
+
+// Makes `profile` the active one and switches to its map. A capture in
+// progress is abandoned.
+void Joystick::selectProfile(uint8_t profile) {
+    if (profile < JOYSTICK_PROFILES) {
+        captureIx = -1;
+        profiles.select(profile);
+        setMap(profiles.getMap());
+    }
+}
+
+//
+void Joystick::nextProfile() {
+    selectProfile((profiles.current() + 1) % JOYSTICK_PROFILES);
+}
+
+//
+void Joystick::nameProfile(uint8_t profile, const uint8_t name[],
+    uint8_t length) {
+    profiles.rename(profile, name, length);
+}
+
+// index of the active profile; its name is copied into `name`
+uint8_t Joystick::getProfile(uint8_t name[PROFILE_NAME_LEN],
+    uint8_t &length) {
+    uint8_t p = profiles.current();
+    length = profiles.getName(p, name);
+    return p;
+}
@@ -20,6 +20,8 @@
 #include <Arduino.h>
 
 #include "config.h"
+#include "eventqueue.h"
+#include "profiles.h"
 #include "targetkbd.h"
 
 // masks
@@ -32,20 +34,64 @@ static const uint8_t JOYSTICK_ALL      = B00011111;
 
 static const uint8_t JOYSTICK_ACTIONS = 5;
 
-static const uint8_t DEFAULT_MAP[JOYSTICK_ACTIONS] = {K_Q, K_A, K_N, K_M, K_Z};
+static_assert(JOYSTICK_ACTIONS == PROFILE_KEYS,
+    "profiles need one key per joystick action");
 
-//
+// action indices of left & right, i.e. bit positions of their masks
+static const uint8_t JOYSTICK_ACTION_LEFT  = 2;
+static const uint8_t JOYSTICK_ACTION_RIGHT = 3;
+
+static const uint8_t DEFAULT_MAP[JOYSTICK_ACTIONS] PROGMEM =
+    {K_Q, K_A, K_N, K_M, K_Z};
+
+/*
+    Joystick on PC0 to PC4, active low. The lines are watched with the PCINT1
+    pin change interrupt, so the main loop doesn't need to poll them, and a
+    busy main loop doesn't delay reading them. The ISR time stamps each
+    change and debounces with a lock-out per line: the first edge on a line
+    is taken right away, and further edges on that line are ignored for
+    `JOYSTICK_DEBOUNCE` ms. When a line settles in a state different from
+    the one taken, e.g. after a very short tap, `process` catches up on it
+    once the lock-out has passed.
+
+    Clean transitions go into a ring of their own, as the event queue can
+    only have one producer context, with the joystick action in place of the
+    key. `process` translates them to target keys with the current map, and
+    moves them into the event queue, keeping their time stamps.
+
+    With autofire on, holding the trigger pulses the fire key at
+    `JOYSTICK_AUTOFIRE_RATE` with `JOYSTICK_AUTOFIRE_DUTY`, driven by the
+    timer 1 compare interrupt, which feeds the same ring.
+
+    The map comes from the active profile, see profiles.h. It's changed by
+    capturing keys from the serial or external keyboard: after
+    `startCapture`, these hand their key events to `capture` instead of
+    queueing them, and each released key is mapped to the next action, in
+    the order up, down, left, right, trigger. Capturing doesn't block, so
+    all other sources keep working meanwhile.
+ */
 class Joystick {
 
 private:
     uint8_t map[JOYSTICK_ACTIONS];
-    uint8_t state;
+    Profiles profiles;
+    uint8_t captured[JOYSTICK_ACTIONS];
+    int8_t captureIx;       // next action to capture, -1 when not capturing
 
 public:
     Joystick();
     void reset();
-    void setMap(uint8_t m[JOYSTICK_ACTIONS]);
-    void process(uint8_t port, TargetKbd *kbd);
+    void setMap(const uint8_t m[JOYSTICK_ACTIONS]);
+    uint8_t getKey(uint8_t action);
+    void startCapture();
+    bool capture(uint8_t key, KeyAction a);
+    void selectProfile(uint8_t profile);
+    void nextProfile();
+    void nameProfile(uint8_t profile, const uint8_t name[], uint8_t length);
+    uint8_t getProfile(uint8_t name[PROFILE_NAME_LEN], uint8_t &length);
+    void setAutofire(bool on);
+    void toggleAutofire();
+    void process(KeyEventQueue *q);
 };
 
 #endif
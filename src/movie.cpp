@@ -0,0 +1,275 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+
+#include "movie.h"
+
+//
+Movie::Movie() {}
+
+//
+void Movie::reset() {
+    DPRINTLN("[MOVI] resetting");
+    head = 0;
+    count = 0;
+    received = 0;
+    limit = 0;
+    resync = false;
+    active = false;
+    running = false;
+    ended = false;
+    late = 0;
+    dropped = 0;
+    joystick = 0;
+    for (uint8_t ix = 0; ix < array_len(matrix); ix++) {
+        matrix[ix] = 0;
+    }
+}
+
+// Adds the records in the payload of a movie frame to the buffer. An empty
+// payload means the host has run out of credits. Records arriving after an
+// end record are dropped, since the host only gets credits for the next
+// movie once the current one has ended.
+void Movie::receive(const uint8_t data[], uint8_t length) {
+
+    active = true;
+
+    if (length == 0) {
+        DPRINTLN("[MOVI] host out of credits");
+        resync = true;
+        return;
+    }
+
+    uint8_t n = length / MOVIE_RECORD_LEN;
+    received += n;
+
+    for (uint8_t ix = 0; ix < n; ix++) {
+        if (count == MOVIE_WINDOW || ended) {
+            dropped++;
+            DPRINTLN("[MOVI] buffer full, dropped: " + String(dropped));
+            continue;
+        }
+        memcpy(records[head], data + ix * MOVIE_RECORD_LEN,
+            MOVIE_RECORD_LEN);
+        ended = (records[head][MOVIE_JOYSTICK] & MOVIE_END) != 0;
+        head = (head + 1) % MOVIE_WINDOW;
+        count++;
+    }
+}
+
+// Fills in the payload of a credits frame to send to the host now, counting
+// in records, and returns its length, 0 if there's nothing to send. The
+// payload is as for the text engine, see `TextKbd::grant`. Credits are handed
+// out a bank at a time. While the end record is in the buffer, no credits are
+// granted, but empty frames are still replied to. The whole buffer is granted
+// again after a movie has ended, which tells the host it's done.
+uint8_t Movie::grant(uint8_t credits[2]) {
+
+    if (!active) {
+        return 0;
+    }
+
+    uint8_t more = ended ? 0 : received + MOVIE_WINDOW - count - limit;
+
+    if (!resync && (more == 0 || (more < MOVIE_BANK_SIZE && count > 0))) {
+        return 0;
+    }
+
+    limit += more;
+    credits[0] = limit;
+    credits[1] = received;
+    DPRINTLN("[MOVI] granting " + String(more) + ", limit: " + String(limit));
+
+    if (resync) {
+        resync = false;
+        return 2;
+    }
+    return 1;
+}
+
+// Queues key events for all records that are due, starting the movie first
+// if needed. A record is only played when there's room for all of its events
+// in the queue, or the queue is empty.
+void Movie::process(FrameSync *sync, KeyEventQueue *q, TargetKbd *kbd,
+    Joystick *joy) {
+
+    if (!running) {
+        if (count < MOVIE_WINDOW && !ended) {
+            return;
+        }
+        start(sync, kbd);
+    }
+
+    advance(sync);
+
+    while (count > 0) {
+
+        uint8_t *rec = records[(head + MOVIE_WINDOW - count) % MOVIE_WINDOW];
+        int16_t due = (rec[MOVIE_FRAME_LO] | (rec[MOVIE_FRAME_HI] << 8))
+            - frame;
+
+        if (due > 0) {
+            return;
+        }
+
+        if ((rec[MOVIE_JOYSTICK] & MOVIE_END) != 0) {
+            for (uint8_t ax = 0; ax < SwitchChip::AX_LINES; ax++) {
+                rec[MOVIE_MATRIX + ax] = 0;
+            }
+            rec[MOVIE_JOYSTICK] = MOVIE_END;
+        }
+
+        if (q->available() < changes(rec, joy) && q->count() > 0) {
+            return;
+        }
+
+        if (due < 0) {
+            late++;
+            DPRINTLN("[MOVI] record late by " + String(-due)
+                + " frame(s), late: " + String(late));
+        }
+
+        play(rec, q, joy);
+        count--;
+
+        if ((rec[MOVIE_JOYSTICK] & MOVIE_END) != 0) {
+            stop(kbd);
+            return;
+        }
+    }
+}
+
+//
+void Movie::start(FrameSync *sync, TargetKbd *kbd) {
+    DPRINTLN("[MOVI] starting");
+    running = true;
+    frame = 0;
+    edges = sync->frames();
+    tick = micros();
+    kbd->setExactTiming(true);
+}
+
+// Ends the movie and drops all buffered records. The keys held by the movie
+// need to have been released already.
+void Movie::stop(TargetKbd *kbd) {
+    DPRINTLN("[MOVI] ended at frame " + String(frame)
+        + ", late: " + String(late));
+    running = false;
+    ended = false;
+    count = 0;
+    head = 0;
+    joystick = 0;
+    for (uint8_t ix = 0; ix < array_len(matrix); ix++) {
+        matrix[ix] = 0;
+    }
+    kbd->setExactTiming(false);
+}
+
+// Advances the frame counter, by the number of sync edges seen when locked,
+// otherwise by the number of frame periods passed. The period is the one
+// measured by frame sync, if there is one, e.g. after losing the signal, and
+// the timing profile's otherwise.
+void Movie::advance(FrameSync *sync) {
+
+    unsigned long now = micros();
+    uint16_t e = sync->frames();
+
+    if (FRAME_SYNC && sync->isLocked()) {
+        frame += e - edges;
+        tick = now;
+    } else {
+        uint16_t p = FRAME_SYNC ? sync->period() : 0;
+        if (p == 0) {
+            p = TIMING.framePeriod;
+        }
+        while (now - tick >= p) {
+            frame++;
+            tick += p;
+        }
+    }
+
+    edges = e;
+}
+
+// number of key events needed for playing record `rec`
+uint8_t Movie::changes(const uint8_t rec[], Joystick *joy) {
+
+    uint8_t n = 0;
+
+    for (uint8_t ax = 0; ax < SwitchChip::AX_LINES; ax++) {
+        for (uint8_t d = matrix[ax] ^ rec[MOVIE_MATRIX + ax]; d != 0;
+            d &= d - 1) {
+            n++;
+        }
+    }
+
+    if (joy != NULL) {
+        for (uint8_t d = (joystick ^ rec[MOVIE_JOYSTICK]) & JOYSTICK_ALL;
+            d != 0; d &= d - 1) {
+            n++;
+        }
+    }
+
+    return n;
+}
+
+// Queues an event for each switch and joystick action that changed with
+// record `rec`. All events but the last are marked as belonging together, so
+// the whole record is committed in one go.
+void Movie::play(const uint8_t rec[], KeyEventQueue *q, Joystick *joy) {
+
+    uint8_t n = changes(rec, joy);
+
+    for (uint8_t ax = 0; ax < SwitchChip::AX_LINES; ax++) {
+        uint8_t to = rec[MOVIE_MATRIX + ax];
+        uint8_t diff = matrix[ax] ^ to;
+        for (uint8_t ay = 0, bit = 1; diff != 0; ay++, bit <<= 1) {
+            if ((diff & bit) != 0) {
+                diff &= ~bit;
+                q->push(SOURCE_MOVIE, ax | (ay << 4),
+                    (to & bit) != 0 ? PRESS_KEY : RELEASE_KEY, --n > 0);
+            }
+        }
+        matrix[ax] = to;
+    }
+
+    if (joy == NULL) {
+        return;
+    }
+
+    uint8_t to = rec[MOVIE_JOYSTICK] & JOYSTICK_ALL;
+    uint8_t diff = joystick ^ to;
+
+    for (uint8_t ix = 0, bit = 1; diff != 0; ix++, bit <<= 1) {
+        if ((diff & bit) != 0) {
+            diff &= ~bit;
+            q->push(SOURCE_MOVIE, joy->getKey(ix),
+                (to & bit) != 0 ? PRESS_KEY : RELEASE_KEY, --n > 0);
+        }
+    }
+
+    joystick = to;
+}
+
+// number of records played after their frame
+uint16_t Movie::lateRecords() {
+    return late;
+}
+
+// number of records received without credit
+uint16_t Movie::drops() {
+    return dropped;
+}
@@ -0,0 +1,105 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+
+#ifndef MOVIE_h
+#define MOVIE_h
+
+#include <Arduino.h>
+
+#include "config.h"
+#include "eventqueue.h"
+#include "framesync.h"
+#include "joystick.h"
+#include "mt88xx.h"
+
+static_assert(MOVIE_BANK_SIZE >= 1 && MOVIE_BANK_SIZE <= 64,
+    "MOVIE_BANK_SIZE needs to be between 1 and 64");
+
+// record layout: frame number (LSB first), joystick state, matrix state
+static const uint8_t MOVIE_FRAME_LO = 0;
+static const uint8_t MOVIE_FRAME_HI = 1;
+static const uint8_t MOVIE_JOYSTICK = 2;
+static const uint8_t MOVIE_MATRIX   = 3;
+static const uint8_t MOVIE_RECORD_LEN = MOVIE_MATRIX + SwitchChip::AX_LINES;
+static const uint8_t MOVIE_WINDOW = 2 * MOVIE_BANK_SIZE;
+
+// joystick state bits; bits 0 to 4 are the joystick actions, pressed when set
+static const uint8_t MOVIE_END = B10000000;
+
+/*
+    Input movie player: the host uploads a timeline of records, each holding
+    the complete state of the target keyboard matrix and the joystick actions
+    for a particular target frame. The matrix state is one AY bit mask per AX
+    line, as in `TargetKbd`, and joystick actions are translated with the
+    current joystick map. Each record is applied on its frame, by queueing key
+    events for the switches that changed since the previous record. While a
+    movie plays, the target keyboard runs with exact timing, i.e. without
+    minimum hold and gap times. A record with `MOVIE_END` set releases all
+    keys held by the movie and ends it.
+
+    Frames are counted with the frame sync signal when locked, otherwise with
+    a timer. The timer uses the frame period measured by frame sync, so it
+    tracks the target's real display rate, and falls back to `framePeriod`
+    from the target's timing profile while there is no measurement. Frame
+    numbers are relative to the start of the movie, and wrap around after
+    65536 frames. The movie starts once the buffer is full, or an end record
+    has arrived, so the host has a full buffer of lead.
+
+    Records are received in `SERIAL_MOVIE` frames, each carrying one or more
+    whole records, and are kept in a ring of two banks. Flow control works as
+    for the text engine (see textkbd.h), but credits are counted in records,
+    and granted in `SERIAL_MOVIE_CREDITS` frames whenever a bank is free, or
+    the buffer has run empty.
+ */
+class Movie {
+
+private:
+    uint8_t records[MOVIE_WINDOW][MOVIE_RECORD_LEN];
+    uint8_t head;
+    uint8_t count;
+    uint8_t received;     // records received, modulo 256
+    uint8_t limit;        // credit limit last granted
+    bool resync;          // host asked for limit and count, see `grant`
+    bool active;          // host has sent records, so it expects credits
+    bool running;         // frame counter started
+    bool ended;           // end record is in buffer
+    uint16_t frame;       // current frame, relative to start of movie
+    uint16_t edges;       // frame sync edge count at last frame update
+    unsigned long tick;   // `micros` time stamp of last timer frame
+    uint8_t matrix[SwitchChip::AX_LINES]; // state held by movie
+    uint8_t joystick;
+    uint16_t late;        // records applied after their frame
+    uint16_t dropped;     // records received without credit
+
+    void start(FrameSync *sync, TargetKbd *kbd);
+    void advance(FrameSync *sync);
+    uint8_t changes(const uint8_t rec[], Joystick *joy);
+    void play(const uint8_t rec[], KeyEventQueue *q, Joystick *joy);
+
+public:
+    Movie();
+    void reset();
+    void receive(const uint8_t data[], uint8_t length);
+    uint8_t grant(uint8_t credits[2]);
+    void stop(TargetKbd *kbd);
+    void process(FrameSync *sync, KeyEventQueue *q, TargetKbd *kbd,
+        Joystick *joy);
+    uint16_t lateRecords();
+    uint16_t drops();
+};
+
+#endif
@@ -16,49 +16,192 @@
 
 #include "mt88xx.h"
 
-// TODO: pass port references?
-MT88xx::MT88xx() {}
+template <typename CHIP>
+uint8_t MT88xx<CHIP>::actions[ACTION_QUEUE_SIZE];
+template <typename CHIP>
+volatile uint8_t MT88xx<CHIP>::head = 0;
+template <typename CHIP>
+volatile uint8_t MT88xx<CHIP>::tail = 0;
 
-//
-void MT88xx::reset() {
+// Sets up timer 2 in CTC mode with prescaler 8 for the output stage. Its
+// interrupt is only enabled while actions are queued. This needs to run in
+// `setup`, after the Arduino core has initialized the timers.
+template <typename CHIP>
+MT88xx<CHIP>::MT88xx() {
+    memset(state, 0, sizeof(state));
+    memset(wanted, 0, sizeof(wanted));
+    pending = false;
+    TCCR2A = _BV(WGM21);
+    TCCR2B = _BV(CS21);
+    OCR2A = STROBE_SPACING_US * 2 - 1;
+    TIMSK2 = 0;
+}
+
+// Resets the chip, dropping all actions not yet written, which opens all
+// switches. The output stage is stopped first, so `tail` may be written here.
+template <typename CHIP>
+void MT88xx<CHIP>::reset() {
     DPRINTLN("[88xx] resetting");
+    TIMSK2 &= ~_BV(OCIE2A);
+    tail = head;
+    memset(state, 0, sizeof(state));
+    memset(wanted, 0, sizeof(wanted));
+    pending = false;
     PORTD |= MASK_RESET;
-    delayMicroseconds(3);
+    __builtin_avr_delay_cycles(
+        NS_TO_CYCLES(CHIP::RESET_NS) > PULSE_MIN_CYCLES ?
+            NS_TO_CYCLES(CHIP::RESET_NS) - PULSE_MIN_CYCLES : 0);
     PORTD &= ~MASK_RESET;
 }
 
 //
-void MT88xx::setSwitch(uint8_t address, bool state) {
-    setAddress(address);
-    setData(state);
+template <typename CHIP>
+void MT88xx<CHIP>::setSwitch(uint8_t address, bool state) {
+    uint8_t ax = address & B00001111;
+    uint8_t bit = 1 << (address >> 4);
+    wanted[ax] = state ? wanted[ax] | bit : wanted[ax] & ~bit;
+    pending = true;
+    flush();
+}
+
+// Brings the switch matrix into state `to`, where each element in this array
+// is the AY bit mask for one AX line. Only switches that differ from the
+// state last applied are written, see `flush`.
+template <typename CHIP>
+void MT88xx<CHIP>::applyMatrix(const uint8_t to[]) {
+    memcpy(wanted, to, sizeof(wanted));
+    pending = true;
+    flush();
+}
+
+// Queues as many actions for reaching the wanted matrix as the output stage
+// can take. All switches to open are queued before any switch to close.
+// Returns whether all actions are queued.
+template <typename CHIP>
+bool MT88xx<CHIP>::flush() {
+    if (pending && queueChanges(false) && queueChanges(true)) {
+        pending = false;
+    }
+    return !pending;
+}
+
+// Queues actions for switches to open or close, until the queue is full.
+// Returns whether all were queued.
+template <typename CHIP>
+bool MT88xx<CHIP>::queueChanges(bool on) {
+
+    for (uint8_t ax = 0; ax < AX_LINES; ax++) {
+        uint8_t diff = (state[ax] ^ wanted[ax]) & (on ? wanted[ax] : state[ax]);
+        for (uint8_t ay = 0; diff != 0; ay++, diff >>= 1) {
+            if ((diff & 1) == 0) {
+                continue;
+            }
+            if (!queue(toAction(ax | (ay << 4), on))) {
+                return false;
+            }
+            state[ax] ^= 1 << ay;
+        }
+    }
+
+    return true;
+}
+
+// precomputes the port bits for setting switch `address` to `on`
+template <typename CHIP>
+uint8_t MT88xx<CHIP>::toAction(uint8_t address, bool on) {
+    // squeeze out AX3, it goes into its own bit
+    uint8_t a = (address & MASK_AX) | ((address >> 1) & MASK_AY);
+    if (AX_LINES > 8 && (address & B00001000) != 0) {
+        a |= ACTION_AX3;
+    }
+    return on ? a | ACTION_DATA : a;
+}
+
+// Adds an action to the queue, and makes sure the output stage is running.
+// Returns false if the queue is full. The ISR may clear the interrupt enable
+// bit concurrently, but then it just runs once more.
+template <typename CHIP>
+bool MT88xx<CHIP>::queue(uint8_t action) {
+
+    uint8_t next = (head + 1) & (ACTION_QUEUE_SIZE - 1);
+
+    if (next == tail) { // full, output stage is running
+        return false;
+    }
+
+    actions[head] = action;
+    __asm__ __volatile__ ("" ::: "memory"); // action stored before `head`
+    head = next;
+    TIMSK2 |= _BV(OCIE2A);
+    return true;
+}
+
+// Output stage, called from the timer ISR: writes the next queued action to
+// the chip, or stops the timer interrupt when there is none.
+template <typename CHIP>
+void MT88xx<CHIP>::onTimer() {
+
+    uint8_t t = tail;
+
+    if (t == head) {
+        TIMSK2 &= ~_BV(OCIE2A);
+        return;
+    }
+
+    uint8_t a = actions[t];
+    setData((a & ACTION_DATA) != 0);
+    setAX012AY(a);
+    setAX3(a);
     strobe();
+    tail = (t + 1) & (ACTION_QUEUE_SIZE - 1);
 }
 
 //
-void MT88xx::strobe() {
+template <typename CHIP>
+void MT88xx<CHIP>::strobe() {
     PORTD |= MASK_STROBE; // strobe HIGH
-    // the data sheet specifies a minimum of 20ns, the minimal reliable value
-    // for delayMicroseconds is 3, which is OK for our application
-    delayMicroseconds(3);
+    // only pad the pulse if the port writes alone are too short
+    __builtin_avr_delay_cycles(
+        NS_TO_CYCLES(CHIP::STROBE_NS) > PULSE_MIN_CYCLES ?
+            NS_TO_CYCLES(CHIP::STROBE_NS) - PULSE_MIN_CYCLES : 0);
     PORTD &= ~MASK_STROBE; // strobe LOW
 }
 
 //
-void MT88xx::setAddress(uint8_t a) {
-    // set address bits AX0-2 and AY0-2 in PORTB, but squeeze out AX3 and
+template <typename CHIP>
+void MT88xx<CHIP>::setAX012AY(uint8_t action) {
+    // set address bits AX0-2 and AY0-2 in PORTB with a single write, but
     // don't touch upper two bits
-    PORTB |= (MASK_AX | MASK_AY);
-    PORTB &= (~(MASK_AX | MASK_AY) | (a & MASK_AX) | ((a >> 1) & MASK_AY));
-    // set AX3, for MT8812/16
-    PORTC |= MASK_AX3;
-    PORTC &= (((a << 2) & MASK_AX3) | ~MASK_AX3);
+    PORTB = (PORTB & ~ACTION_ADDRESS) | (action & ACTION_ADDRESS);
+}
+
+//
+template <typename CHIP>
+void MT88xx<CHIP>::setAX3(uint8_t action) {
+    // AX3 is only present on MT8812/16
+    if (AX_LINES > 8) {
+        if ((action & ACTION_AX3) != 0) {
+            PORTC |= MASK_AX3;
+        } else {
+            PORTC &= ~MASK_AX3;
+        }
+    }
 }
 
 //
-void MT88xx::setData(bool on) {
+template <typename CHIP>
+void MT88xx<CHIP>::setData(bool on) {
     if (on) {
         PORTD |= MASK_DATA;
     } else {
         PORTD &= ~MASK_DATA;
     }
 }
+
+// only the chip selected in config.h is needed
+template class MT88xx<MT88XX_CHIP>;
+
+// output stage
+ISR(TIMER2_COMPA_vect) {
+    SwitchChip::onTimer();
+}
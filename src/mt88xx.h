@@ -31,18 +31,105 @@ static const uint8_t MASK_AY     = B00111000;
 // masks within PORTC
 static const uint8_t MASK_AX3    = B00100000;
 
-//
+// Switch actions for the output stage are single bytes, with the address bits
+// already in place for PORTB, plus AX3 and data.
+static const uint8_t ACTION_ADDRESS = MASK_AX | MASK_AY;
+static const uint8_t ACTION_AX3     = B01000000;
+static const uint8_t ACTION_DATA    = B10000000;
+
+// Number of switch actions the output stage can hold; needs to be a power of
+// 2. When full, remaining actions are queued on later calls to `flush`.
+static const uint8_t ACTION_QUEUE_SIZE = 32;
+
+// Time between two strobes in µs. Timer 2 runs at 2 MHz, so the longest
+// possible spacing is 128 µs.
+static const uint8_t STROBE_SPACING_US = 8;
+
+// converts a duration in ns into the number of CPU cycles covering it
+#define NS_TO_CYCLES( ns ) \
+    (((uint32_t)(ns) * (F_CPU / 1000000UL) + 999UL) / 1000UL)
+
+// A set bit followed by a cleared bit in an I/O port (`sbi` & `cbi`) keeps
+// the pin high for at least this many cycles.
+static const uint8_t PULSE_MIN_CYCLES = 2;
+
+/*
+    Chip variants, to be selected via `MT88XX_CHIP` in config.h. Each variant
+    gives its number of AX lines, and the minimum strobe and reset pulse widths
+    in ns as specified in its data sheet for VDD = 5V. Setup & hold times for
+    address and data are well below one CPU cycle on all variants, so they're
+    covered by the time the port writes take anyway.
+ */
+struct MT8808 {
+    static const uint8_t AX_LINES = 8;
+    static const uint16_t STROBE_NS = 100;
+    static const uint16_t RESET_NS = 100;
+};
+
+struct MT8812 {
+    static const uint8_t AX_LINES = 12;
+    static const uint16_t STROBE_NS = 50;
+    static const uint16_t RESET_NS = 50;
+};
+
+struct MT8816 {
+    static const uint8_t AX_LINES = 16;
+    static const uint16_t STROBE_NS = 20;
+    static const uint16_t RESET_NS = 40;
+};
+
+/*
+    Driver for the switch chip. Address & strobe handling is generated at
+    compile time for the given chip variant, so for example AX3 is never
+    touched on an MT8808, and strobe & reset pulses are only as long as the
+    data sheet requires.
+
+    Switches are not set directly. Instead, switch actions are precomputed
+    and queued, and the output stage, an ISR on timer 2, writes them to the
+    chip one at a time, `STROBE_SPACING_US` apart. That way, strobe timing
+    doesn't depend on whatever else the main loop is doing, and the time
+    until a change reaches the target is bounded by the number of queued
+    actions. The queue has a single producer, the main loop, and `head` is
+    only written there, `tail` only in the ISR.
+
+    Queueing never waits for the output stage. Applying a matrix only records
+    the wanted switch states, and queues as many actions as fit. `flush`
+    queues the rest as the output stage makes room, and needs to be called
+    from the main loop. So it's safe to apply a matrix with interrupts
+    disabled.
+ */
+template <typename CHIP>
 class MT88xx {
 
 private:
-    void setAddress(uint8_t a);
-    void setData(bool on);
-    void strobe();
+    static uint8_t actions[ACTION_QUEUE_SIZE];
+    static volatile uint8_t head;
+    static volatile uint8_t tail;
+
+    uint8_t state[CHIP::AX_LINES];  // switch states as queued
+    uint8_t wanted[CHIP::AX_LINES]; // switch states as last applied
+    bool pending;                   // `wanted` not fully queued yet
+
+    static void setAX012AY(uint8_t action);
+    static void setAX3(uint8_t action);
+    static void setData(bool on);
+    static void strobe();
+    uint8_t toAction(uint8_t address, bool on);
+    bool queue(uint8_t action);
+    bool queueChanges(bool on);
 
 public:
+    static const uint8_t AX_LINES = CHIP::AX_LINES;
+
     MT88xx();
     void reset();
     void setSwitch(uint8_t address, bool state);
+    void applyMatrix(const uint8_t to[]);
+    bool flush();
+    static void onTimer();
 };
 
+// the switch chip selected in config.h
+typedef MT88xx<MT88XX_CHIP> SwitchChip;
+
 #endif
@@ -0,0 +1,126 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+
+#include <util/atomic.h>
+
+#include "paddle.h"
+
+// written by the ISR only
+static volatile uint16_t reading = PADDLE_CENTER;
+
+// adds up samples, publishing their average after each full set
+ISR(ADC_vect) {
+    static uint16_t sum = 0;
+    static uint8_t count = 0;
+    sum += ADC;
+    if (++count == PADDLE_OVERSAMPLING) {
+        reading = sum / PADDLE_OVERSAMPLING;
+        sum = 0;
+        count = 0;
+    }
+}
+
+// Starts the ADC in free running mode on A6, with AVcc as reference and the
+// slowest clock, i.e. about 9600 samples per second.
+Paddle::Paddle() {
+    ADMUX = _BV(REFS0) | PADDLE_CHANNEL;
+    ADCSRB = 0;
+    ADCSRA = _BV(ADEN) | _BV(ADSC) | _BV(ADATE) | _BV(ADIE)
+        | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+}
+
+//
+void Paddle::reset() {
+    DPRINTLN("[PADL] resetting");
+    position = PADDLE_CENTER;
+    action = NA;
+    key = NA;
+    pressed = false;
+}
+
+// Queues key events for the current paddle position. Called on each pass of
+// the main loop.
+void Paddle::process(KeyEventQueue *q, Joystick *joy) {
+
+    uint16_t r;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        r = reading;
+    }
+
+    if (r > position + PADDLE_HYSTERESIS || r + PADDLE_HYSTERESIS < position) {
+        position = r;
+    }
+
+    uint8_t a = NA;
+    uint16_t deflection = 0;
+
+    if (position + PADDLE_DEADZONE < PADDLE_CENTER) {
+        a = JOYSTICK_ACTION_LEFT;
+        deflection = PADDLE_CENTER - PADDLE_DEADZONE - position;
+    } else if (position > PADDLE_CENTER + PADDLE_DEADZONE) {
+        a = JOYSTICK_ACTION_RIGHT;
+        deflection = position - PADDLE_CENTER - PADDLE_DEADZONE;
+    }
+
+    unsigned long now = millis();
+
+    if (a != action) {
+        DPRINTLN("[PADL] position: " + String(position));
+        setKey(false, q);
+        action = a;
+        if (a == NA) {
+            return;
+        }
+        key = joy != NULL ? joy->getKey(a) : pgm_read_byte(DEFAULT_MAP + a);
+        phase = now;
+        setKey(true, q);
+        return;
+    }
+
+    if (action == NA) {
+        return;
+    }
+
+    unsigned long elapsed = now - phase;
+
+    if (elapsed >= PADDLE_PERIOD) {
+        phase = now;
+        setKey(true, q);
+    } else if (elapsed >= onTime(deflection)) {
+        setKey(false, q);
+    }
+}
+
+// on time in ms within a pulse period for given deflection
+uint16_t Paddle::onTime(uint16_t deflection) {
+
+    uint16_t on = (uint32_t)PADDLE_PERIOD * deflection
+        / (PADDLE_CENTER - PADDLE_DEADZONE);
+
+    if (on + TIMING.minGap >= PADDLE_PERIOD) {
+        return PADDLE_PERIOD; // held permanently
+    }
+    return on < TIMING.minHold ? TIMING.minHold : on;
+}
+
+//
+void Paddle::setKey(bool on, KeyEventQueue *q) {
+    if (on != pressed && key != NA) {
+        q->push(SOURCE_PADDLE, key, on ? PRESS_KEY : RELEASE_KEY);
+        pressed = on;
+    }
+}
@@ -0,0 +1,61 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+
+#ifndef PADDLE_h
+#define PADDLE_h
+
+#include <Arduino.h>
+
+#include "config.h"
+#include "eventqueue.h"
+#include "joystick.h"
+
+static const uint8_t PADDLE_CHANNEL = 6;        // A6, ADC only on the Nano
+static const uint8_t PADDLE_OVERSAMPLING = 16;  // samples per reading
+static const uint16_t PADDLE_CENTER = 512;
+static const uint16_t PADDLE_DEADZONE = 48;     // around center
+static const uint8_t PADDLE_HYSTERESIS = 8;
+
+/*
+    Paddle on A6: the ADC runs in free running mode, and its ISR adds up
+    `PADDLE_OVERSAMPLING` samples for each reading, which keeps it short
+    enough to not get in the way of the PS/2 ISR. `process` ignores changes
+    in reading smaller than `PADDLE_HYSTERESIS`, to avoid jitter. Outside of
+    the dead zone around center, the joystick's left or right key is pressed,
+    pulsed with period `PADDLE_PERIOD`. The on time grows with the deflection,
+    and the key is held permanently at full deflection. On and off times are
+    never shorter than the target's minimum hold and gap times.
+ */
+class Paddle {
+
+private:
+    uint16_t position;      // current reading after hysteresis, 0 to 1023
+    uint8_t action;         // joystick action being pulsed, `NA` if none
+    uint8_t key;            // target key being pulsed
+    bool pressed;
+    unsigned long phase;    // `millis` time stamp when current pulse started
+
+    uint16_t onTime(uint16_t deflection);
+    void setKey(bool on, KeyEventQueue *q);
+
+public:
+    Paddle();
+    void reset();
+    void process(KeyEventQueue *q, Joystick *joy);
+};
+
+#endif
@@ -0,0 +1,232 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+
+#include "profiles.h"
+#include "tables.h"
+
+// `defaults` is the key map in flash for profiles without a record
+Profiles::Profiles(const uint8_t *defaults) {
+    load(defaults);
+}
+
+// Restores all profiles from EEPROM, see class comment.
+void Profiles::load(const uint8_t *defaults) {
+
+    for (uint8_t p = 0; p < JOYSTICK_PROFILES; p++) {
+        memcpy_P(maps[p], defaults, PROFILE_KEYS);
+        memset(names[p], 0, PROFILE_NAME_LEN);
+        latest[p] = NA;
+    }
+
+    active = 0;
+    head = NA;
+    seq = 0;
+    dirty = 0;
+    written = PROFILE_RECORD_LEN;
+
+    ProfileRecord r;
+    ProfileRecord n;
+
+    for (uint8_t slot = 0; slot < PROFILE_SLOTS; slot++) {
+        if (read(slot, r) && !(read((slot + 1) % PROFILE_SLOTS, n)
+            && n.seq == (uint8_t)(r.seq + 1))) {
+            head = slot;
+            seq = r.seq;
+            break;
+        }
+    }
+
+    if (head == NA) {
+        DPRINTLN("[PROF] no profiles stored");
+        return;
+    }
+
+    for (uint8_t ix = 0, slot = head; ix < PROFILE_SLOTS;
+        ix++, slot = (slot + PROFILE_SLOTS - 1) % PROFILE_SLOTS) {
+
+        if (!read(slot, r) || latest[r.profile] != NA) {
+            continue;
+        }
+
+        DPRINTLN("[PROF] profile " + String(r.profile) + " in slot "
+            + String(slot));
+        latest[r.profile] = slot;
+        if (isValidMap(r.map)) {
+            memcpy(maps[r.profile], r.map, PROFILE_KEYS);
+        } else {
+            DPRINTLN("[PROF] invalid keys, using default map");
+        }
+        memcpy(names[r.profile], r.name, PROFILE_NAME_LEN);
+        if (ix == 0) {
+            active = r.profile;
+        }
+    }
+}
+
+// reads the record in `slot`; returns whether it is valid
+bool Profiles::read(uint8_t slot, ProfileRecord &r) {
+    eeprom_read_block(&r,
+        (const void *)(PROFILE_EEPROM_BASE + slot * PROFILE_RECORD_LEN),
+        PROFILE_RECORD_LEN);
+    return r.profile < JOYSTICK_PROFILES && r.check == checksum(r);
+}
+
+// Whether all keys of map `m` exist on this target. A record may pass its
+// CRC but still have been written by a build for another target or switch
+// chip, and the target keyboard does no bounds checks on keys.
+bool Profiles::isValidMap(const uint8_t m[PROFILE_KEYS]) {
+    for (uint8_t ix = 0; ix < PROFILE_KEYS; ix++) {
+        uint8_t k = m[ix];
+        if (k != NA && !isPlainKey(k) && !isComboKey(k) && !isMacroKey(k)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// CRC-8 of record `r`; the number of AX lines of the switch chip is folded
+// in, so records written for another chip don't pass
+uint8_t Profiles::checksum(const ProfileRecord &r) {
+    const uint8_t *data = (const uint8_t *)&r;
+    uint8_t c = _crc8_ccitt_update(PROFILE_CRC_SEED, SwitchChip::AX_LINES);
+    for (uint8_t ix = 0; ix < PROFILE_RECORD_LEN - 1; ix++) {
+        c = _crc8_ccitt_update(c, data[ix]);
+    }
+    return c;
+}
+
+// slot the next record goes into
+uint8_t Profiles::nextSlot() {
+    return head == NA ? 0 : (head + 1) % PROFILE_SLOTS;
+}
+
+// Picks the profile to write next. A profile whose latest record is about to
+// be overwritten goes first. When that's not the active one, the active one
+// needs to be written again afterwards, so it stays the newest. Otherwise,
+// the active profile goes last for the same reason.
+uint8_t Profiles::pick() {
+
+    uint8_t slot = nextSlot();
+
+    for (uint8_t p = 0; p < JOYSTICK_PROFILES; p++) {
+        if (latest[p] == slot) {
+            if (p != active) {
+                dirty |= _BV(active);
+            }
+            return p;
+        }
+    }
+
+    for (uint8_t p = 0; p < JOYSTICK_PROFILES; p++) {
+        if ((dirty & _BV(p)) != 0 && p != active) {
+            return p;
+        }
+    }
+
+    return active;
+}
+
+// starts writing the current state of `profile` as the newest record
+void Profiles::write(uint8_t profile) {
+    record.seq = seq + 1;
+    record.profile = profile;
+    memcpy(record.map, maps[profile], PROFILE_KEYS);
+    memcpy(record.name, names[profile], PROFILE_NAME_LEN);
+    record.check = checksum(record);
+    dirty &= ~_BV(profile);
+    written = 0;
+}
+
+// Writes the next byte of the pending record when the EEPROM is ready, or
+// starts on the next record if there are changes waiting.
+void Profiles::process() {
+
+    if (written < PROFILE_RECORD_LEN) {
+
+        if (!eeprom_is_ready()) {
+            return;
+        }
+
+        uint8_t slot = nextSlot();
+        eeprom_update_byte((uint8_t *)(PROFILE_EEPROM_BASE
+            + slot * PROFILE_RECORD_LEN + written),
+            ((const uint8_t *)&record)[written]);
+
+        if (++written == PROFILE_RECORD_LEN) {
+            DPRINTLN("[PROF] stored profile " + String(record.profile)
+                + " in slot " + String(slot));
+            head = slot;
+            seq = record.seq;
+            latest[record.profile] = slot;
+        }
+        return;
+    }
+
+    if (dirty != 0) {
+        write(pick());
+    }
+}
+
+// index of the active profile
+uint8_t Profiles::current() {
+    return active;
+}
+
+// key map of the active profile
+const uint8_t *Profiles::getMap() {
+    return maps[active];
+}
+
+// sets the key map of the active profile
+void Profiles::store(const uint8_t m[PROFILE_KEYS]) {
+    memcpy(maps[active], m, PROFILE_KEYS);
+    dirty |= _BV(active);
+}
+
+//
+void Profiles::select(uint8_t profile) {
+    if (profile < JOYSTICK_PROFILES && profile != active) {
+        DPRINTLN("[PROF] selecting profile " + String(profile));
+        active = profile;
+        dirty |= _BV(profile);
+    }
+}
+
+// sets the name of `profile`, cut to `PROFILE_NAME_LEN` characters
+void Profiles::rename(uint8_t profile, const uint8_t name[], uint8_t length) {
+    if (profile >= JOYSTICK_PROFILES) {
+        return;
+    }
+    for (uint8_t ix = 0; ix < PROFILE_NAME_LEN; ix++) {
+        names[profile][ix] = ix < length ? name[ix] : 0;
+    }
+    dirty |= _BV(profile);
+}
+
+// copies the name of `profile` into `name`; returns its length
+uint8_t Profiles::getName(uint8_t profile, uint8_t name[PROFILE_NAME_LEN]) {
+    uint8_t length = 0;
+    if (profile < JOYSTICK_PROFILES) {
+        while (length < PROFILE_NAME_LEN && names[profile][length] != 0) {
+            name[length] = names[profile][length];
+            length++;
+        }
+    }
+    return length;
+}
@@ -0,0 +1,101 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef PROFILES_h
+#define PROFILES_h
+
+#include <Arduino.h>
+
+#include "config.h"
+
+static_assert(JOYSTICK_PROFILES >= 1 && JOYSTICK_PROFILES <= 8,
+    "JOYSTICK_PROFILES needs to be between 1 and 8");
+
+// keys per profile, one for each joystick action
+static const uint8_t PROFILE_KEYS = 5;
+static const uint8_t PROFILE_NAME_LEN = 8;
+
+// EEPROM area holding the profile records
+static const uint16_t PROFILE_EEPROM_BASE = 0;
+static const uint8_t PROFILE_SLOTS = 32;
+
+// Initial value for the record CRC. It's not 0, so that neither zeroed nor
+// erased EEPROM passes as a valid record.
+static const uint8_t PROFILE_CRC_SEED = 0xa5;
+
+//
+struct ProfileRecord {
+    uint8_t seq;        // incremented with each record written
+    uint8_t profile;
+    uint8_t map[PROFILE_KEYS];
+    char name[PROFILE_NAME_LEN]; // padded with 0
+    uint8_t check;      // CRC-8 over all of the above, see `PROFILE_CRC_SEED`
+};
+
+static const uint8_t PROFILE_RECORD_LEN = sizeof(ProfileRecord);
+
+/*
+    Joystick profiles, i.e. key maps with a name, kept in EEPROM. One profile
+    is active at any time, and is restored after reset.
+
+    For wear levelling, the EEPROM area is used as a ring of `PROFILE_SLOTS`
+    records. Each change to a profile, including making it the active one,
+    writes a record with its current state into the slot after the newest
+    record, so all slots are written equally often. The newest record is
+    the one not followed by a valid record with the next sequence number,
+    and it names the active profile. For every other profile, its latest
+    record is found by walking back from there. Before a slot holding the
+    latest record of a profile gets overwritten, that record is copied
+    forward, i.e. written again as the newest one, so no profile gets lost.
+
+    Writing a byte to EEPROM takes about 3.3 ms, so a record is written one
+    byte per call to `process`, and only when the EEPROM is ready. Changes
+    made meanwhile are marked in `dirty`, and written once the current record
+    is complete.
+ */
+class Profiles {
+
+private:
+    uint8_t maps[JOYSTICK_PROFILES][PROFILE_KEYS];
+    char names[JOYSTICK_PROFILES][PROFILE_NAME_LEN];
+    uint8_t latest[JOYSTICK_PROFILES]; // slot of latest record, `NA` if none
+    uint8_t active;
+    uint8_t head;       // slot of newest record, `NA` if none
+    uint8_t seq;        // sequence number of newest record
+    uint8_t dirty;      // bit mask of profiles waiting to be written
+    ProfileRecord record; // record being written
+    uint8_t written;    // bytes of `record` written so far
+
+    void load(const uint8_t *defaults);
+    bool read(uint8_t slot, ProfileRecord &r);
+    bool isValidMap(const uint8_t m[PROFILE_KEYS]);
+    uint8_t checksum(const ProfileRecord &r);
+    uint8_t nextSlot();
+    uint8_t pick();
+    void write(uint8_t profile);
+
+public:
+    Profiles(const uint8_t *defaults);
+    uint8_t current();
+    const uint8_t *getMap();
+    void store(const uint8_t m[PROFILE_KEYS]);
+    void select(uint8_t profile);
+    void rename(uint8_t profile, const uint8_t name[], uint8_t length);
+    uint8_t getName(uint8_t profile, uint8_t name[PROFILE_NAME_LEN]);
+    void process();
+};
+
+#endif
@@ -0,0 +1,109 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+
+#include "schedule.h"
+
+//
+Scheduler::Scheduler() {}
+
+//
+void Scheduler::reset() {
+    DPRINTLN("[SCHD] resetting");
+    clear();
+    late = 0;
+    dropped = 0;
+}
+
+// drops all pending events
+void Scheduler::clear() {
+    count = 0;
+}
+
+// number of free slots in the list
+uint8_t Scheduler::available() {
+    return SCHEDULE_SIZE - count;
+}
+
+// adds all entries in the payload of a timed events frame to the list
+void Scheduler::receive(const uint8_t data[], uint8_t length) {
+
+    for (uint8_t ix = 0; ix + SCHEDULE_ENTRY_LEN <= length;
+        ix += SCHEDULE_ENTRY_LEN) {
+
+        unsigned long due = (unsigned long)data[ix]
+            | ((unsigned long)data[ix + 1] << 8)
+            | ((unsigned long)data[ix + 2] << 16)
+            | ((unsigned long)data[ix + 3] << 24);
+
+        if (count == SCHEDULE_SIZE) {
+            dropped++;
+            DPRINTLN("[SCHD] list full, dropped: " + String(dropped));
+            continue;
+        }
+
+        insert(due, data[ix + 4]);
+    }
+}
+
+// Inserts an event into the list, keeping it in descending order of due time.
+// Events with equal due times stay in the order they were received.
+void Scheduler::insert(unsigned long due, uint8_t event) {
+
+    uint8_t ix = count;
+
+    while (ix > 0 && (long)(pending[ix - 1].due - due) <= 0) {
+        pending[ix] = pending[ix - 1];
+        ix--;
+    }
+
+    pending[ix].due = due;
+    pending[ix].event = event;
+    count++;
+}
+
+// hands all due events to the serial keyboard, as long as the queue has room
+void Scheduler::process(SerialKbd *kbd, KeyEventQueue *q, Joystick *joy) {
+
+    while (count > 0 && q->available() > 0) {
+
+        TimedEvent &e = pending[count - 1];
+        unsigned long behind = micros() - e.due;
+
+        if ((long)behind < 0) {
+            return;
+        }
+
+        if (behind > SCHEDULE_LATE_US) {
+            late++;
+            DPRINTLN("[SCHD] event late by " + String(behind)
+                + " µs, late: " + String(late));
+        }
+
+        kbd->processEvents(&e.event, 1, q, joy);
+        count--;
+    }
+}
+
+// number of events played more than `SCHEDULE_LATE_US` late
+uint16_t Scheduler::lateEvents() {
+    return late;
+}
+
+// number of events received while list was full
+uint16_t Scheduler::drops() {
+    return dropped;
+}
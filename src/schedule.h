@@ -0,0 +1,85 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+
+#ifndef SCHEDULE_h
+#define SCHEDULE_h
+
+#include <Arduino.h>
+
+#include "config.h"
+#include "eventqueue.h"
+#include "joystick.h"
+#include "serialkbd.h"
+
+static_assert(SCHEDULE_SIZE >= 8 && SCHEDULE_SIZE <= 64,
+    "SCHEDULE_SIZE needs to be between 8 and 64");
+
+// entry layout in timed event frames: due time (`micros`, LSB first), event
+static const uint8_t SCHEDULE_ENTRY_LEN = 5;
+
+// events played later than this many µs after their due time count as late
+static const uint16_t SCHEDULE_LATE_US = 1000;
+
+//
+struct TimedEvent {
+    unsigned long due;  // `micros` time stamp
+    uint8_t event;      // v2 key event, see serialparser.h
+};
+
+/*
+    Timed events: the host sends key events along with the time at which they
+    should happen on the target, in terms of our `micros`. To that end, the
+    host first synchronizes its clock with ours via clock sync frames, and
+    then sends each event a little ahead of time. Events are kept in a list
+    ordered by due time, and are handed to the serial keyboard when due. That
+    way, jitter on the serial line doesn't affect the timing of key strokes.
+    Events that are already due on arrival are played right away.
+
+    Due events are polled from the main loop, so an event is handed over
+    within one pass of the loop after its due time. The target keyboard may
+    then hold the switch change back further, by up to the minimum hold or
+    gap time of the switch, or until the end of the current scan when frame
+    sync is locked, see targetkbd.h. So timing is as good as the loop pass
+    plus that deferral, not as good as `micros`.
+
+    The list is kept in descending order of due time, so the next event to
+    play is always at the end, and removing it is cheap. Due times are
+    compared relative to each other, so wrap around of `micros` is fine, as
+    long as no event is scheduled more than 35 minutes ahead.
+ */
+class Scheduler {
+
+private:
+    TimedEvent pending[SCHEDULE_SIZE];
+    uint8_t count;
+    uint16_t late;      // events played more than `SCHEDULE_LATE_US` late
+    uint16_t dropped;   // events received while list was full
+
+    void insert(unsigned long due, uint8_t event);
+
+public:
+    Scheduler();
+    void reset();
+    void clear();
+    uint8_t available();
+    void receive(const uint8_t data[], uint8_t length);
+    void process(SerialKbd *kbd, KeyEventQueue *q, Joystick *joy);
+    uint16_t lateEvents();
+    uint16_t drops();
+};
+
+#endif
@@ -15,6 +15,7 @@
 */
 
 #include "serialkbd.h"
+#include "serialparser.h"
 
 //
 SerialKbd::SerialKbd() {
@@ -24,14 +25,14 @@ SerialKbd::SerialKbd() {
 //
 void SerialKbd::reset() {
     DPRINTLN("[ SER] resetting");
-    joystickMapIx = -1;
 }
 
-//
-void SerialKbd::process(uint8_t readBuf[2], TargetKbd *kbd, Joystick *joy) {
+// handles a protocol v1 frame
+void SerialKbd::process(const uint8_t frame[], KeyEventQueue *q,
+    Joystick *joy) {
 
-    uint8_t makeBreak = readBuf[0];
-    uint8_t code = readBuf[1];
+    uint8_t makeBreak = frame[0];
+    uint8_t code = frame[1];
     KeyAction a;
 
     switch (makeBreak) {
@@ -46,25 +47,44 @@ void SerialKbd::process(uint8_t readBuf[2], TargetKbd *kbd, Joystick *joy) {
             return;
     }
 
+    processKey(code, a, q, joy);
+}
+
+// handles the payload of a protocol v2 events frame
+void SerialKbd::processEvents(const uint8_t events[], uint8_t count,
+    KeyEventQueue *q, Joystick *joy) {
+
+    for (uint8_t ix = 0; ix < count; ix++) {
+        uint8_t e = events[ix];
+        processKey(e & SERIAL_EVENT_CODE,
+            (e & SERIAL_EVENT_MAKE) != 0 ? PRESS_KEY : RELEASE_KEY, q, joy);
+    }
+}
+
+//
+void SerialKbd::processKey(uint8_t code, KeyAction a, KeyEventQueue *q,
+    Joystick *joy) {
+
     uint8_t key = map->translate(code);
     DPRINTLN("[ SER] action: " + String(a) + ", code: " + String(code) +
         ", key: " + String(key));
 
     if (code == 59) { // start joystick map setup (F1); TODO: make configurable
         if (a == RELEASE_KEY && joy != NULL) {
-            DPRINTLN("[ SER] setting joystick");
-            joystickMapIx = 0;
+            joy->startCapture();
         }
 
-    } else if (joystickMapIx < 0) { // regular key handling
-        kbd->handleKey(key, a);
+    } else if (code == 62) { // toggle autofire (F4)
+        if (a == RELEASE_KEY && joy != NULL) {
+            joy->toggleAutofire();
+        }
 
-    } else if (a == RELEASE_KEY) { // collecting joystick map
-        DPRINTLN("[ SER] joystick setup " + String(key));
-        joystickMap[joystickMapIx++] = key;
-        if (joystickMapIx == array_len(joystickMap)) {
-            joystickMapIx = -1;
-            joy->setMap(joystickMap);
+    } else if (code == 63) { // next joystick profile (F5)
+        if (a == RELEASE_KEY && joy != NULL) {
+            joy->nextProfile();
         }
+
+    } else if (joy == NULL || !joy->capture(key, a)) { // regular key handling
+        q->push(SOURCE_SERIAL, key, a);
     }
 }
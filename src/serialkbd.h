@@ -20,6 +20,7 @@
 #include <Arduino.h>
 
 #include "config.h"
+#include "eventqueue.h"
 #include "joystick.h"
 #include "keymap.h"
 #include "targetkbd.h"
@@ -29,13 +30,16 @@ class SerialKbd {
 
 private:
     KeyMap *map;
-    uint8_t joystickMap[JOYSTICK_ACTIONS];
-    int8_t joystickMapIx = -1;
+
+    void processKey(uint8_t code, KeyAction a, KeyEventQueue *q,
+        Joystick *joy);
 
 public:
     SerialKbd();
     void reset();
-    void process(uint8_t readBuf[2], TargetKbd *kbd, Joystick *joy);
+    void process(const uint8_t frame[], KeyEventQueue *q, Joystick *joy);
+    void processEvents(const uint8_t events[], uint8_t count,
+        KeyEventQueue *q, Joystick *joy);
 };
 
 #endif
@@ -0,0 +1,182 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <util/crc16.h>
+
+#include "serialparser.h"
+
+//
+SerialParser::SerialParser() {
+    crcErrors = 0;
+    lostFrames = 0;
+    txSeq = 0;
+    heard = 0;
+    v2 = false;
+    reset();
+}
+
+//
+void SerialParser::reset() {
+    len = 0;
+    rxSeq = 0;
+}
+
+// Feeds the next received byte to the parser. Returns the kind of frame this
+// byte completed, if any. The frame can then be retrieved via `frame`, or in
+// case of a v2 frame via `type` and `payload`. The buffer is only valid until
+// the next call to `feed`.
+SerialFrame SerialParser::feed(uint8_t b) {
+
+    unsigned long now = millis();
+    bool quiet = now - heard > SERIAL_V1_FALLBACK_TIMEOUT;
+    heard = now;
+
+    if (len > 0 && (now - started) > SERIAL_FRAME_TIMEOUT) {
+        DPRINTLN("[ SER] frame timed out, dropping "
+            + String(len) + " byte(s)");
+        len = 0;
+    }
+
+    if (len == 0) {
+        if (!isFrameStart(b, quiet)) {
+            DPRINTLN("[ SER] out of sync, dropping: " + String(b));
+            return FRAME_NONE;
+        }
+        started = now;
+    }
+
+    buf[len++] = b;
+
+    if (buf[0] != SERIAL_SYNC) {
+        if (len < SERIAL_V1_FRAME_LEN) {
+            return FRAME_NONE;
+        }
+        len = 0;
+        return FRAME_V1;
+    }
+
+    if (len == SERIAL_HEADER_LEN && payloadLength() > SERIAL_MAX_PAYLOAD) {
+        DPRINTLN("[ SER] payload too long: " + String(payloadLength()));
+        len = 0;
+        return FRAME_NONE;
+    }
+
+    if (len < SERIAL_HEADER_LEN
+        || len < SERIAL_HEADER_LEN + payloadLength() + 1) {
+        return FRAME_NONE;
+    }
+
+    len = 0;
+    return checkFrame();
+}
+
+//
+SerialFrame SerialParser::checkFrame() {
+
+    uint8_t l = SERIAL_HEADER_LEN - 1 + payloadLength();
+
+    if (crc(buf + 1, l) != buf[l + 1]) {
+        crcErrors++;
+        DPRINTLN("[ SER] CRC error, errors so far: " + String(crcErrors));
+        return FRAME_NONE;
+    }
+
+    uint8_t seq = buf[2];
+    if (seq != rxSeq) {
+        lostFrames += (uint8_t)(seq - rxSeq);
+        DPRINTLN("[ SER] sequence gap, lost frames so far: "
+            + String(lostFrames));
+    }
+    rxSeq = seq + 1;
+    v2 = true;
+
+    return FRAME_V2;
+}
+
+//
+uint8_t *SerialParser::frame() {
+    return buf;
+}
+
+//
+uint8_t SerialParser::type() {
+    return buf[1];
+}
+
+//
+uint8_t *SerialParser::payload() {
+    return buf + SERIAL_HEADER_LEN;
+}
+
+//
+uint8_t SerialParser::payloadLength() {
+    return buf[3];
+}
+
+//
+void SerialParser::send(uint8_t type, const uint8_t *payload, uint8_t length) {
+
+    uint8_t header[SERIAL_HEADER_LEN] = {SERIAL_SYNC, type, txSeq++, length};
+    uint8_t c = crc(header + 1, SERIAL_HEADER_LEN - 1);
+
+    for (uint8_t ix = 0; ix < length; ix++) {
+        c = _crc8_ccitt_update(c, payload[ix]);
+    }
+
+    Serial.write(header, SERIAL_HEADER_LEN);
+    Serial.write(payload, length);
+    Serial.write(c);
+}
+
+//
+uint8_t SerialParser::crc(const uint8_t *data, uint8_t length) {
+    uint8_t c = 0;
+    for (uint8_t ix = 0; ix < length; ix++) {
+        c = _crc8_ccitt_update(c, data[ix]);
+    }
+    return c;
+}
+
+// Whether `b` may start a frame. In v2, a v1 command is only accepted when
+// the line has been `quiet` before, and then switches back to v1.
+bool SerialParser::isFrameStart(uint8_t b, bool quiet) {
+    switch (b) {
+        case SERIAL_SYNC:
+            return true;
+        case '?':
+        case '!':
+        case 'V':
+            if (v2 && quiet) {
+                DPRINTLN("[ SER] back to v1");
+                v2 = false;
+            }
+            return !v2;
+        case 0: // break
+        case 1: // make
+            return !v2;
+    }
+    return false;
+}
+
+// number of frames dropped due to CRC errors
+uint16_t SerialParser::errors() {
+    return crcErrors;
+}
+
+// number of frames lost, as told by gaps in sequence numbers
+uint16_t SerialParser::lost() {
+    return lostFrames;
+}
@@ -0,0 +1,146 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef SERIALPARSER_h
+#define SERIALPARSER_h
+
+#include <Arduino.h>
+
+#include "config.h"
+
+/*
+    Protocol v1 frames are always two bytes long: either `{make/break, code}`,
+    or `{command, argument}`.
+
+    Protocol v2 frames look like this:
+
+        | SYNC | TYPE | SEQ | LEN | PAYLOAD ... | CRC |
+
+    `SYNC` is always `SERIAL_SYNC`, `SEQ` is incremented by the sender for each
+    frame, `LEN` is the payload length, and `CRC` is a CRC-8 (polynomial 0x07,
+    initial value 0) over `TYPE`, `SEQ`, `LEN`, and the payload. For frame type
+    `SERIAL_EVENTS`, each payload byte is one key event, with bit 7 set for
+    make and cleared for break, and the key code in bits 0 to 6. The payload
+    of a `SERIAL_TEXT` frame is text to type on the target, see textkbd.h. We
+    reply with `SERIAL_CREDITS` frames, carrying the credit limit, i.e. the
+    total number of bytes the host may have sent, modulo 256. In reply to an
+    empty `SERIAL_TEXT` frame, the limit is followed by the number of bytes
+    received so far, modulo 256. Likewise, `SERIAL_MOVIE` frames carry records of an input movie,
+    see movie.h, and are flow controlled with `SERIAL_MOVIE_CREDITS` frames,
+    counting in records.
+
+    For playing key events with exact timing, the host first sends an empty
+    `SERIAL_CLOCK` frame, to which we reply with a `SERIAL_CLOCK` frame
+    carrying our `micros` time (4 bytes, LSB first). From a few of those
+    exchanges, the host can estimate offset and drift of our clock relative
+    to its own. It then sends `SERIAL_TIMED_EVENTS` frames, with each event
+    preceded by its due time in terms of our `micros`, see schedule.h.
+
+    Once the host has sent a `SERIAL_HEARTBEAT` frame, it needs to keep doing
+    so, or its keys get released, see watchdog.h. An empty `SERIAL_STATS`
+    frame is replied to with a `SERIAL_STATS` frame carrying counters for
+    problems seen so far, each 2 bytes, LSB first, in this order: event queue
+    overflows, CRC errors, lost frames, text bytes dropped, late movie
+    records, dropped movie records, late timed events, dropped timed events,
+    and keys released by the watchdog.
+
+    A `SERIAL_PROFILE` frame selects the joystick profile given in its first
+    payload byte, and names it with the remaining bytes, if any. An empty one
+    changes nothing. We reply with a `SERIAL_PROFILE` frame carrying the
+    active profile, the number of profiles, and the active profile's name.
+
+    A host switches to v2 by first sending the v1 command `{'V', version}`.
+    When the adapter supports v2, it replies with a `SERIAL_CAPABILITIES`
+    frame, otherwise the command is ignored and the host stays with v1. Its
+    payload is the protocol version, maximum payload length, size of the
+    text buffer, size of the movie buffer in records, movie record length,
+    and number of timed events that can be pending.
+ */
+static const uint8_t SERIAL_PROTOCOL_VERSION = 2;
+
+static const uint8_t SERIAL_V1_FRAME_LEN = 2;
+static const uint8_t SERIAL_SYNC         = 0xa5;
+static const uint8_t SERIAL_HEADER_LEN   = 4; // sync, type, sequence, length
+static const uint8_t SERIAL_MAX_PAYLOAD  = 32;
+
+// v2 frame types
+static const uint8_t SERIAL_EVENTS       = 'E';
+static const uint8_t SERIAL_CAPABILITIES = 'C';
+static const uint8_t SERIAL_TEXT         = 'X';
+static const uint8_t SERIAL_CREDITS      = 'K';
+static const uint8_t SERIAL_MOVIE        = 'P';
+static const uint8_t SERIAL_MOVIE_CREDITS = 'R';
+static const uint8_t SERIAL_CLOCK        = 'S';
+static const uint8_t SERIAL_TIMED_EVENTS = 'D';
+static const uint8_t SERIAL_HEARTBEAT    = 'H';
+static const uint8_t SERIAL_STATS        = '#';
+static const uint8_t SERIAL_PROFILE      = 'J';
+
+// masks for v2 key events
+static const uint8_t SERIAL_EVENT_MAKE   = B10000000;
+static const uint8_t SERIAL_EVENT_CODE   = B01111111;
+
+//
+enum SerialFrame {
+    FRAME_NONE,
+    FRAME_V1,
+    FRAME_V2
+};
+
+/*
+    Byte level parser for frames received via the serial port. Bytes are fed
+    one by one, as they come out of the serial receive buffer. A frame always
+    starts with either a v1 make/break byte (`0` or `1`), a v1 command
+    character (`?`, `!`, `V`), or the v2 `SERIAL_SYNC` byte. After the first
+    valid v2 frame, only `SERIAL_SYNC` starts a frame, and a v1 command only
+    after `SERIAL_V1_FALLBACK_TIMEOUT` of silence, which switches back to v1.
+    Any other byte seen at the start of a frame is dropped, and a partially received frame is
+    discarded when its remaining bytes do not arrive within
+    `SERIAL_FRAME_TIMEOUT`. That way, the parser gets back in step with the
+    sender after losing a byte. v2 frames failing the CRC check are dropped.
+ */
+class SerialParser {
+
+private:
+    uint8_t buf[SERIAL_HEADER_LEN + SERIAL_MAX_PAYLOAD + 1];
+    uint8_t len;
+    unsigned long started; // `millis` time stamp of first byte of frame
+    unsigned long heard;   // `millis` time stamp of last byte received
+    bool v2;               // host has switched to v2, see class comment
+    uint8_t rxSeq;         // expected sequence number of next v2 frame
+    uint8_t txSeq;
+
+    uint16_t crcErrors;
+    uint16_t lostFrames;
+
+    bool isFrameStart(uint8_t b, bool quiet);
+    SerialFrame checkFrame();
+    uint8_t crc(const uint8_t *data, uint8_t length);
+
+public:
+    SerialParser();
+    void reset();
+    SerialFrame feed(uint8_t b);
+    uint8_t *frame();
+    uint8_t type();
+    uint8_t *payload();
+    uint8_t payloadLength();
+    void send(uint8_t type, const uint8_t *payload, uint8_t length);
+    uint16_t errors();
+    uint16_t lost();
+};
+
+#endif
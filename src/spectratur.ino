@@ -17,10 +17,18 @@
 #include <Arduino.h>
 
 #include "config.h"
+#include "eventqueue.h"
 #include "externalkbd.h"
+#include "framesync.h"
 #include "serialkbd.h"
+#include "serialparser.h"
 #include "joystick.h"
+#include "movie.h"
+#include "paddle.h"
+#include "schedule.h"
 #include "targetkbd.h"
+#include "textkbd.h"
+#include "watchdog.h"
 
 
 static const uint8_t PS2_DATAPIN = 4;
@@ -28,12 +36,27 @@ static const uint8_t PS2_IRQPIN  = 3;
 
 
 // --- key sources ------------------------------------------------------------
+SerialParser *serialParser = NULL;
 ExternalKbd *externalKbd = NULL;
 SerialKbd *serialKbd = NULL;
+TextKbd *textKbd = NULL;
+Movie *movie = NULL;
+Scheduler *scheduler = NULL;
 Joystick *joystick = NULL;
+Paddle *paddle = NULL;
+
+// --- key events from sources to sink ---------------------------------------
+KeyEventQueue *events = NULL;
+
+static_assert(EVENT_QUEUE_SIZE > SERIAL_MAX_PAYLOAD,
+    "event queue needs to hold a full serial frame");
+static_assert(MOVIE_RECORD_LEN <= SERIAL_MAX_PAYLOAD,
+    "a movie record needs to fit into a serial frame");
 
 // --- key sink ---------------------------------------------------------------
 TargetKbd *targetKbd = NULL;
+FrameSync *frameSync = NULL;
+Watchdog *watchdog = NULL;
 
 // ------------------------------------------------------------------ SETUP ---
 
@@ -42,7 +65,7 @@ void setup() {
     /* port D (digital pins 0 to 7)
         bit 0: (serial port TX, don't use or touch)
             1: (serial port RX, don't use or touch)
-            2: input pull-up (reserve; interrupt capable)
+            2: input pull-up, frame sync from target (optional, INT0)
             3: PS/2 library: KBD clock; interrupt capable
             4: PS/2 library: KBD data
             5: output, MT88xx RESET
@@ -64,19 +87,36 @@ void setup() {
     PORTB = B11000000;
 
     /* port C (analog pins 0 to 5)
-        bit 0: input pull-up, joystick UP
-            1: input pull-up, joystick DOWN
-            2: input pull-up, joystick LEFT
-            3: input pull-up, joystick RIGHT
-            4: input pull-up, joystick TRIGGER
-            5: output, MT8812/16 AX3
+        bit 0: input pull-up, joystick UP (PCINT8)
+            1: input pull-up, joystick DOWN (PCINT9)
+            2: input pull-up, joystick LEFT (PCINT10)
+            3: input pull-up, joystick RIGHT (PCINT11)
+            4: input pull-up, joystick TRIGGER (PCINT12)
+            5: output, MT8812/16 AX3; input pull-up for MT8808
             6: input pull-up (not accessible)
             7: input pull-up (not accessible) */
-    DDRC  = B00100000;
-    PORTC = B11011111;
+    if (SwitchChip::AX_LINES > 8) {
+        DDRC  = B00100000;
+        PORTC = B11011111;
+    } else {
+        DDRC  = B00000000;
+        PORTC = B11111111;
+    }
+
+    frameSync = new FrameSync();
+    if (FRAME_SYNC) {
+        frameSync->begin();
+    }
 
-    targetKbd = new TargetKbd();
+    // sets up timer 2 for the switch chip's output stage, see mt88xx.h
+    targetKbd = new TargetKbd(frameSync);
+    events = new KeyEventQueue();
+    watchdog = new Watchdog();
+    serialParser = new SerialParser();
     serialKbd = new SerialKbd();
+    textKbd = new TextKbd();
+    movie = new Movie();
+    scheduler = new Scheduler();
 
     if (EXTERNAL_KBD) {
         externalKbd = new ExternalKbd(PS2_DATAPIN, PS2_IRQPIN);
@@ -86,6 +126,11 @@ void setup() {
         joystick = new Joystick();
     }
 
+    // A6 is an analog only input, so it needs no port setup
+    if (PADDLE) {
+        paddle = new Paddle();
+    }
+
     Serial.begin(115200);
     reset();
 }
@@ -94,27 +139,98 @@ void setup() {
 
 void loop() {
 
-    if (Serial.available() > 1) {
-        uint8_t buf[2] = {0, 0};
-        Serial.readBytes(buf, 2);
-        if (!handleSerial(buf) && (serialKbd != NULL)) {
-            serialKbd->process(buf, targetKbd, joystick);
+    // The serial receive buffer is filled by the UART interrupt, so we drain
+    // everything that arrived since the last pass, handling each complete
+    // frame as it is recognized. We pause when the event queue or the list of
+    // timed events could not take another full frame, and continue on a later
+    // pass when there's room again. The remaining bytes wait in the receive
+    // buffer meanwhile.
+    while (Serial.available() > 0
+        && events->available() >= SERIAL_MAX_PAYLOAD
+        && scheduler->available() >= SERIAL_MAX_PAYLOAD / SCHEDULE_ENTRY_LEN) {
+        switch (serialParser->feed(Serial.read())) {
+            case FRAME_V1: {
+                uint8_t *buf = serialParser->frame();
+                if (!handleSerial(buf) && (serialKbd != NULL)) {
+                    serialKbd->process(buf, events, joystick);
+                }
+                break;
+            }
+            case FRAME_V2:
+                handleFrame();
+                break;
+            default:
+                break;
         }
     }
 
-    if (externalKbd != NULL) {
-        externalKbd->process(targetKbd, joystick);
+    if (externalKbd != NULL && externalKbd->process(events, joystick)) {
+        reset(); // Esc
     }
 
     if (joystick != NULL) {
-        joystick->process(PINC, targetKbd);
+        joystick->process(events);
+    }
+
+    if (paddle != NULL) {
+        paddle->process(events, joystick);
+    }
+
+    if (watchdog->process(targetKbd)) { // host lost, stop what it started
+        scheduler->clear();
+        movie->stop(targetKbd);
+    }
+
+    scheduler->process(serialKbd, events, joystick);
+    movie->process(frameSync, events, targetKbd, joystick);
+    dispatchEvents();
+    textKbd->process(targetKbd);
+    targetKbd->process();
+
+    uint8_t credits[2];
+    uint8_t len = textKbd->grant(credits);
+    if (len > 0) {
+        serialParser->send(SERIAL_CREDITS, credits, len);
+    }
+
+    len = movie->grant(credits);
+    if (len > 0) {
+        serialParser->send(SERIAL_MOVIE_CREDITS, credits, len);
+    }
+}
+
+// The single consumer stage: hands all queued key events to the target
+// keyboard in the order they were queued, past the stuck key watchdog. The
+// matrix is committed after each event, unless the event is marked as having
+// more events belonging to it. While the target keyboard is busy with a combo
+// or a toggle, events stay queued.
+void dispatchEvents() {
+
+    KeyEvent e;
+    bool pending = false;
+
+    while (!targetKbd->isBusy() && events->pop(e)) {
+        DPRINTLN("[MAIN] event: source " + String(e.source) + ", key "
+            + String(e.key) + ", action " + String(e.action) + " @ "
+            + String(e.time));
+        if (watchdog->track(e)) {
+            targetKbd->updateKey(e.key, (KeyAction)e.action);
+        }
+        pending = e.more;
+        if (!pending) {
+            targetKbd->commit();
+        }
+    }
+
+    if (pending) { // last event of a group not yet queued, commit anyway
+        targetKbd->commit();
     }
 }
 
 // ----------------------------------------------------------------------------
 
 //
-bool handleSerial(uint8_t buf[2]) {
+bool handleSerial(uint8_t buf[SERIAL_V1_FRAME_LEN]) {
 
     DPRINTLN("[MAIN] serial: {"
         + String(buf[0]) + ", " + String(buf[1]) + "}");
@@ -126,6 +242,9 @@ bool handleSerial(uint8_t buf[2]) {
         case '!':
             reset();
             break;
+        case 'V':
+            capabilities();
+            break;
         default:
             return false;
     }
@@ -133,15 +252,120 @@ bool handleSerial(uint8_t buf[2]) {
     return true;
 }
 
+//
+void handleFrame() {
+
+    DPRINTLN("[MAIN] frame: " + String(serialParser->type())
+        + ", length: " + String(serialParser->payloadLength()));
+
+    switch (serialParser->type()) {
+        case SERIAL_EVENTS:
+            if (serialKbd != NULL) {
+                serialKbd->processEvents(serialParser->payload(),
+                    serialParser->payloadLength(), events, joystick);
+            }
+            break;
+        case SERIAL_TEXT:
+            textKbd->receive(
+                serialParser->payload(), serialParser->payloadLength());
+            break;
+        case SERIAL_MOVIE:
+            movie->receive(
+                serialParser->payload(), serialParser->payloadLength());
+            break;
+        case SERIAL_CLOCK:
+            syncClock();
+            break;
+        case SERIAL_TIMED_EVENTS:
+            scheduler->receive(
+                serialParser->payload(), serialParser->payloadLength());
+            break;
+        case SERIAL_HEARTBEAT:
+            watchdog->heartbeat();
+            break;
+        case SERIAL_STATS:
+            stats();
+            break;
+        case SERIAL_PROFILE:
+            profile();
+            break;
+        default:
+            DPRINTLN("[MAIN] unknown frame type");
+    }
+}
+
 //
 void hello() {
     Serial.println("spectratur");
 }
 
+// replies to protocol version request with our capabilities
+void capabilities() {
+    uint8_t caps[] = {
+        SERIAL_PROTOCOL_VERSION, SERIAL_MAX_PAYLOAD, TEXT_BUFFER_SIZE - 1,
+        MOVIE_WINDOW, MOVIE_RECORD_LEN, SCHEDULE_SIZE};
+    serialParser->send(SERIAL_CAPABILITIES, caps, sizeof(caps));
+}
+
+// replies to stats request with all problem counters
+void stats() {
+    uint16_t counters[] = {
+        events->overflows(), serialParser->errors(), serialParser->lost(),
+        textKbd->drops(), movie->lateRecords(), movie->drops(),
+        scheduler->lateEvents(), scheduler->drops(), watchdog->releases()};
+    uint8_t s[2 * array_len(counters)];
+    for (uint8_t ix = 0; ix < array_len(counters); ix++) {
+        s[2 * ix] = counters[ix] & 0xff;
+        s[2 * ix + 1] = counters[ix] >> 8;
+    }
+    serialParser->send(SERIAL_STATS, s, sizeof(s));
+}
+
+// Handles a joystick profile frame: the first payload byte selects that
+// profile, any further bytes name it. Replies with the active profile, the
+// number of profiles, and the active profile's name.
+void profile() {
+
+    if (joystick == NULL) {
+        return;
+    }
+
+    const uint8_t *p = serialParser->payload();
+    uint8_t len = serialParser->payloadLength();
+
+    if (len > 1) {
+        joystick->nameProfile(p[0], p + 1, len - 1);
+    }
+    if (len > 0) {
+        joystick->selectProfile(p[0]);
+    }
+
+    uint8_t reply[2 + PROFILE_NAME_LEN];
+    uint8_t length;
+    reply[0] = joystick->getProfile(reply + 2, length);
+    reply[1] = JOYSTICK_PROFILES;
+    serialParser->send(SERIAL_PROFILE, reply, 2 + length);
+}
+
+// replies to clock sync request with our current time
+void syncClock() {
+    unsigned long now = micros();
+    uint8_t t[] = {
+        (uint8_t)now, (uint8_t)(now >> 8), (uint8_t)(now >> 16),
+        (uint8_t)(now >> 24)};
+    serialParser->send(SERIAL_CLOCK, t, sizeof(t));
+}
+
 //
 void reset() {
     DPRINTLN("[MAIN] resetting");
+    serialParser->reset();
+    events->clear();
     serialKbd->reset();
+    textKbd->reset();
+    movie->reset();
+    scheduler->reset();
+    watchdog->reset();
     targetKbd->reset();
     if (externalKbd != NULL) {
         externalKbd->reset();
@@ -149,5 +373,8 @@ void reset() {
     if (joystick != NULL) {
         joystick->reset();
     }
+    if (paddle != NULL) {
+        paddle->reset();
+    }
     hello();
 }
@@ -0,0 +1,242 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef TABLES_h
+#define TABLES_h
+
+#include <Arduino.h>
+
+#include "config.h"
+#include "mt88xx.h"
+
+/*
+    Lookup tables that are generated by the compiler from the definitions in
+    the target header. Before that, the definitions are checked, so that any
+    mistake in them stops compilation, rather than causing havoc at runtime.
+    The runtime can therefore rely on all keys found in these tables being
+    valid.
+
+    To expand a table, we need a pack of all its indexes, which
+    `MakeIndices<N>::type` provides.
+ */
+template <uint16_t... I> struct Indices {};
+
+template <uint16_t N, uint16_t... I>
+struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+
+template <uint16_t... I>
+struct MakeIndices<0, I...> {
+    typedef Indices<I...> type;
+};
+
+/* --- validation -------------------------------------------------------------
+
+    Note that these are evaluated by the compiler only. When a combo or macro
+    lacks its `NA` terminator, `keysLength` reads past the end of the array,
+    which is not allowed in a constant expression, so compilation fails.
+ */
+
+// number of keys before the `NA` terminator
+constexpr uint8_t keysLength(const uint8_t *keys) {
+    return *keys == NA ? 0 : 1 + keysLength(keys + 1);
+}
+
+// whether key is a plain key that exists on the selected switch chip
+constexpr bool isPlainKey(uint8_t k) {
+    return (k & K_SPECIAL) == 0 && (k & K_MASK_AX) < SwitchChip::AX_LINES;
+}
+
+// whether key references a combo
+constexpr bool isComboKey(uint8_t k) {
+    return (k & K_SPECIAL) != 0 && (k & ~K_SPECIAL) < END_OF_COMBOS;
+}
+
+// whether key references a macro
+constexpr bool isMacroKey(uint8_t k) {
+    return k != NA && (k & K_SPECIAL) != 0
+        && (k & ~K_SPECIAL) > END_OF_COMBOS
+        && (k & ~K_SPECIAL) < END_OF_SPECIALS;
+}
+
+// combos may only contain plain keys
+constexpr bool isValidCombo(const uint8_t *keys) {
+    return *keys == NA || (isPlainKey(*keys) && isValidCombo(keys + 1));
+}
+
+// macros may contain plain keys and combos
+constexpr bool isValidMacro(const uint8_t *keys) {
+    return *keys == NA ||
+        ((isPlainKey(*keys) || isComboKey(*keys)) && isValidMacro(keys + 1));
+}
+
+//
+constexpr bool isToggle(const uint8_t *keys) {
+    return *keys == TOGGLE;
+}
+
+// combos may start with `TOGGLE`
+constexpr bool isValidToggleCombo(const uint8_t *keys) {
+    return isValidCombo(keys + (isToggle(keys) ? 1 : 0));
+}
+
+//
+constexpr bool isValidSpecial(uint8_t ix) {
+    return ix < END_OF_COMBOS ?
+            isValidToggleCombo(SPECIALS[ix].keys)
+        : ix == END_OF_COMBOS ?
+            SPECIALS[ix].keys == NULL
+        : isValidMacro(SPECIALS[ix].keys) && keysLength(SPECIALS[ix].keys) > 0;
+}
+
+//
+constexpr bool specialsInOrder(uint8_t ix) {
+    return ix >= END_OF_SPECIALS ||
+        (SPECIALS[ix].id == ix && specialsInOrder(ix + 1));
+}
+
+//
+constexpr bool specialsValid(uint8_t ix) {
+    return ix >= END_OF_SPECIALS ||
+        (isValidSpecial(ix) && specialsValid(ix + 1));
+}
+
+//
+constexpr bool mapValid(uint8_t ix) {
+    return ix >= array_len(MAP_INPUT_TO_TARGET) ||
+        ((MAP_INPUT_TO_TARGET[ix] == NA
+            || isPlainKey(MAP_INPUT_TO_TARGET[ix])
+            || isComboKey(MAP_INPUT_TO_TARGET[ix])
+            || isMacroKey(MAP_INPUT_TO_TARGET[ix]))
+        && mapValid(ix + 1));
+}
+
+// modifier needs to be a plain key, the key may also be a combo
+constexpr bool isValidTextKey(TextKey t) {
+    return t.key == NA ? t.modifier == NA
+        : (t.modifier == NA || isPlainKey(t.modifier))
+            && (isPlainKey(t.key) || isComboKey(t.key));
+}
+
+//
+constexpr bool textMapValid(uint8_t ix) {
+    return ix >= array_len(MAP_TEXT_TO_TARGET) ||
+        (isValidTextKey(MAP_TEXT_TO_TARGET[ix]) && textMapValid(ix + 1));
+}
+
+static_assert((K_SPECIAL | END_OF_SPECIALS) <= TOGGLE,
+    "too many specials, END_OF_SPECIALS must be lower than TOGGLE");
+static_assert(specialsInOrder(0),
+    "SPECIALS table does not follow the order of the SPECIALS enumeration");
+static_assert(specialsValid(0),
+    "invalid combo or macro, check that combos only contain plain keys, "
+    "macros only plain keys & combos, and all keys fit the MT88xx chip");
+static_assert(array_len(MAP_INPUT_TO_TARGET) <= 128,
+    "MAP_INPUT_TO_TARGET must not have more than 128 entries");
+static_assert(mapValid(0),
+    "MAP_INPUT_TO_TARGET contains invalid keys, check that all keys fit the "
+    "MT88xx chip and all specials exist");
+static_assert(array_len(MAP_TEXT_TO_TARGET) == '~' - ' ' + 1,
+    "MAP_TEXT_TO_TARGET needs one entry per printable ASCII character");
+static_assert(textMapValid(0) && isValidTextKey(TEXT_NEWLINE),
+    "MAP_TEXT_TO_TARGET or TEXT_NEWLINE contains invalid keys, check that "
+    "modifiers are plain keys and all keys fit the MT88xx chip");
+
+/* --- combos -----------------------------------------------------------------
+
+    Each combo is turned into one AY bit mask per AX line of the switch chip,
+    so pressing, releasing, or toggling a combo comes down to a few byte wide
+    operations on the keyboard matrix. In the table, each combo starts with
+    a flags byte and its modifier, i.e. the first of its keys, followed by the
+    masks. The modifier is `NA` for combos with a single key. The entry of
+    combo `c` is found at `COMBOS::table[c * COMBO_STRIDE]` in flash.
+ */
+static const uint8_t COMBO_TOGGLE = B00000001;
+static const uint8_t COMBO_STRIDE = 2 + SwitchChip::AX_LINES;
+
+// AY bit mask of all keys in `combo` that are on AX line `ax`
+constexpr uint8_t comboRowMask(const uint8_t *combo, uint8_t ax) {
+    return *combo == NA ? 0 :
+        (((*combo & K_SPECIAL) == 0 && (*combo & K_MASK_AX) == ax) ?
+            1 << ((*combo & K_MASK_AY) >> 4) : 0)
+        | comboRowMask(combo + 1, ax);
+}
+
+// first key of a combo with more than one key, `NA` otherwise
+constexpr uint8_t comboModifier(const uint8_t *keys) {
+    return keysLength(keys) > 1 ? *keys : NA;
+}
+
+// byte at offset `o` of combo table entry
+constexpr uint8_t comboEntry(const uint8_t *combo, uint8_t o) {
+    return o == 0 ? (isToggle(combo) ? COMBO_TOGGLE : 0)
+        : o == 1 ? comboModifier(combo + (isToggle(combo) ? 1 : 0))
+        : comboRowMask(combo, o - 2);
+}
+
+template <typename T> struct ComboTable;
+
+template <uint16_t... I>
+struct ComboTable<Indices<I...> > {
+    static const uint8_t table[sizeof...(I)];
+};
+
+template <uint16_t... I>
+const uint8_t ComboTable<Indices<I...> >::table[sizeof...(I)] PROGMEM = {
+    comboEntry(SPECIALS[I / COMBO_STRIDE].keys, I % COMBO_STRIDE)...
+};
+
+typedef ComboTable<MakeIndices<END_OF_COMBOS * COMBO_STRIDE>::type> COMBOS;
+
+/* --- macros -----------------------------------------------------------------
+
+    Macros are stored with a fixed stride, which is one more than the longest
+    macro. Each entry starts with the macro's length, followed by its keys. The
+    entry of macro `m` (counting from 0 after the combo/macro divider) is
+    found at `MACROS::table[m * MACRO_STRIDE]` in flash.
+ */
+static const uint8_t MACRO_COUNT = END_OF_SPECIALS - END_OF_COMBOS - 1;
+
+//
+constexpr uint8_t maxMacroLength(uint8_t ix) {
+    return ix >= END_OF_SPECIALS ? 0 :
+        keysLength(SPECIALS[ix].keys) > maxMacroLength(ix + 1) ?
+            keysLength(SPECIALS[ix].keys) : maxMacroLength(ix + 1);
+}
+
+static const uint8_t MACRO_STRIDE = 1 + maxMacroLength(END_OF_COMBOS + 1);
+
+// byte at offset `o` of macro table entry
+constexpr uint8_t macroEntry(const uint8_t *macro, uint8_t o) {
+    return o == 0 ? keysLength(macro) :
+        o <= keysLength(macro) ? macro[o - 1] : NA;
+}
+
+template <typename T> struct MacroTable;
+
+template <uint16_t... I>
+struct MacroTable<Indices<I...> > {
+    static const uint8_t table[sizeof...(I) + 1];
+};
+
+template <uint16_t... I>
+const uint8_t MacroTable<Indices<I...> >::table[sizeof...(I) + 1] PROGMEM = {
+    macroEntry(SPECIALS[END_OF_COMBOS + 1 + I / MACRO_STRIDE].keys,
+        I % MACRO_STRIDE)...
+};
+
+typedef MacroTable<MakeIndices<MACRO_COUNT * MACRO_STRIDE>::type> MACROS;
+
+#endif
@@ -17,10 +17,14 @@
 #include "targetkbd.h"
 
 //
-TargetKbd::TargetKbd() {}
+TargetKbd::TargetKbd(FrameSync *s) : sync(s), exact(false) {
+    stopMacro();
+}
 
 //
 void TargetKbd::reset() {
+    exact = false;
+    stopMacro();
     clearKeyboardMatrix();
     mt88xx.reset();
 }
@@ -29,14 +33,25 @@ void TargetKbd::reset() {
 void TargetKbd::clearKeyboardMatrix() {
     for (uint8_t ix = 0; ix < array_len(kbdMatrix); ix++) {
         kbdMatrix[ix] = 0;
+        switchMatrix[ix] = 0;
+        latchMatrix[ix] = 0;
+        youngMatrix[ix] = 0;
+        pendingMatrix[ix] = 0;
+    }
+    young = false;
+    dirty = false;
+    comboPending = NA;
+    settleDue = millis();
+    for (uint8_t ix = 0; ix < array_len(holds); ix++) {
+        holds[ix] = 0;
     }
 }
 
-//
-void TargetKbd::typeKey(uint8_t k) {
-    pressKey(k);
-    delay(100);
-    releaseKey(k);
+// Types key `k`, i.e. presses and releases it, while holding `modifier`, if
+// given. This is played like a macro, so it's ignored while a macro plays.
+void TargetKbd::typeKey(uint8_t k, uint8_t modifier) {
+    typed = k;
+    playMacro(&typed, 1, false, modifier);
 }
 
 //
@@ -54,8 +69,18 @@ void TargetKbd::releaseKey(uint8_t k) {
     handleKey(k, RELEASE_KEY);
 }
 
-//
+// Handles given key and immediately commits the resulting matrix state.
 void TargetKbd::handleKey(uint8_t k, KeyAction a) {
+    updateKey(k, a);
+    commit();
+}
+
+// Updates the desired matrix state according to given key, but does not
+// yet commit it. Use this for changes that belong together, e.g. joystick
+// diagonals, and call `commit` when done. The key needs to come from the
+// target tables, which have been validated at compile time (see tables.h),
+// so there are no bounds checks here.
+void TargetKbd::updateKey(uint8_t k, KeyAction a) {
 
     if (k == NA) {
         DPRINTLN("[TRGT] unassigned key");
@@ -66,139 +91,494 @@ void TargetKbd::handleKey(uint8_t k, KeyAction a) {
         return;
     }
 
-    if (!isValidKeyAddress(k)) {
-        DPRINTLN("[TRGT] invalid key address: " + String(k));
-        return;
-    }
-
     uint8_t ax = k & K_MASK_AX;
     uint8_t ay = (k & K_MASK_AY) >> 4; // shift out 4 AX bits
 
-    bool data = false;
+    DPRINTLN("[TRGT] key: " + String(k) + ", ax: " + String(ax)
+        + ", ay: " + String(ay) + ", action: " + String(a));
+
+    holdSwitch(ax, ay, a);
+}
+
+// Adds or removes a hold on the given switch, or flips its toggle latch. The
+// switch only changes state in the desired matrix when its hold count goes
+// from 0 to 1 or from 1 to 0.
+void TargetKbd::holdSwitch(uint8_t ax, uint8_t ay, KeyAction a) {
+
+    uint8_t &h = holds[(ax << 3) | ay];
+    uint8_t bit = 1 << ay;
+
+    if (a == FLIP_KEY) {
+        latchMatrix[ax] ^= bit;
+        a = (latchMatrix[ax] & bit) != 0 ? PRESS_KEY : RELEASE_KEY;
+        DPRINTLN("[TRGT] toggle latched: " + String(a));
+    }
 
     switch (a) {
         case PRESS_KEY:
-            data = true;
+            if (h < 0xff) {
+                h++;
+            }
             break;
         case RELEASE_KEY:
-            data = false;
+            if (h > 0) {
+                h--;
+            }
             break;
-        case FLIP_KEY:
-            data = !getKeyState(ax, ay);
-            DPRINTLN("[TRGT] flipping to: " + String(data));
+        default:
             break;
     }
 
-    DPRINTLN("[TRGT] key: " + String(k) + ", address: " + String(k) + ", ax: "
-        + String(ax) + ", ay: " + String(ay) + ", data: " + String(data));
+    setKeyState(ax, ay, h > 0);
+}
+
+// Commits the desired matrix state to the switch chip. When synced to the
+// target's scans, this is deferred until the current scan is done.
+void TargetKbd::commit() {
+    if (isSynced()) {
+        dirty = true;
+    } else {
+        apply();
+    }
+}
+
+// Queues actions for all switches whose state differs between desired and
+// committed matrix, except for switches that changed too recently according
+// to the target's timing. A switch to open stays closed until it has been closed for
+// `minHold`, a switch to close stays open until it has been open for `minGap`.
+// The latter is remembered, so the switch closes later on even if its key is
+// released meanwhile. `process` commits again until all young switches have
+// aged.
+void TargetKbd::apply() {
+
+    uint8_t now = millis();
+    uint8_t hold = minHold();
+    uint8_t gap = minGap();
+    uint8_t window = hold > gap ? hold : gap;
+    window = window > TIMING.repeatGap ? window : TIMING.repeatGap;
+    uint8_t to[SwitchChip::AX_LINES];
+    young = false;
+
+    for (uint8_t ax = 0; ax < SwitchChip::AX_LINES; ax++) {
+
+        uint8_t closed = switchMatrix[ax];
+        uint8_t diff = closed ^ (kbdMatrix[ax] | pendingMatrix[ax]);
+        uint8_t bits = diff | youngMatrix[ax];
+        uint8_t *changed = changedAt + (ax << 3);
+        to[ax] = closed;
+
+        for (uint8_t ay = 0, bit = 1; bits != 0; ay++, bit <<= 1) {
+
+            if ((bits & bit) == 0) {
+                continue;
+            }
+            bits &= ~bit;
+
+            uint8_t age = now - changed[ay];
+            bool isYoung = (youngMatrix[ax] & bit) != 0;
+
+            if ((diff & bit) == 0) { // no change, just aging
+                if (age >= window) {
+                    youngMatrix[ax] &= ~bit;
+                }
+                continue;
+            }
+
+            if ((closed & bit) != 0) { // opening
+                if (isYoung && age < hold) {
+                    continue;
+                }
+                to[ax] &= ~bit;
+            } else { // closing
+                if (isYoung && age < gap) {
+                    pendingMatrix[ax] |= bit;
+                    continue;
+                }
+                to[ax] |= bit;
+                pendingMatrix[ax] &= ~bit;
+            }
+
+            changed[ay] = now;
+            youngMatrix[ax] |= bit;
+        }
 
-    mt88xx.setSwitch(k, data);
+        young = young || youngMatrix[ax] != 0;
+    }
 
-    // track key's on/off state
-    setKeyState(ax, ay, data);
+    mt88xx.applyMatrix(to);
+    for (uint8_t ix = 0; ix < array_len(to); ix++) {
+        switchMatrix[ix] = to[ix];
+    }
+    dirty = false;
+}
 
-    //delay(100);
+// whether a frame sync signal from the target is present
+bool TargetKbd::isSynced() {
+    return FRAME_SYNC && sync->isLocked();
 }
 
-//
-bool TargetKbd::isSpecial(uint8_t key) {
-    return ((key & K_SPECIAL) == K_SPECIAL)
-        && ((key & ~K_SPECIAL) < END_OF_SPECIALS);
+// Minimum time in ms a switch stays closed. When synced, commits only happen
+// in between two scans, so there is at least one scan between any two commits
+// that are more than half a scan period apart. The timing profile still
+// applies on top of that, since the ROM may need more than one scan.
+uint8_t TargetKbd::minHold() {
+    if (exact) {
+        return 0;
+    }
+    return atLeastHalfScan(TIMING.minHold);
+}
+
+// minimum time in ms a switch stays open, see `minHold`
+uint8_t TargetKbd::minGap() {
+    if (exact) {
+        return 0;
+    }
+    return atLeastHalfScan(TIMING.minGap);
+}
+
+// the larger of `ms` and half the measured scan period when synced
+uint8_t TargetKbd::atLeastHalfScan(uint8_t ms) {
+    if (!isSynced()) {
+        return ms;
+    }
+    uint8_t half = sync->period() / 2000 + 1;
+    return half > ms ? half : ms;
+}
+
+// Turns off minimum hold and gap times, so matrix changes are committed
+// exactly when requested. Used during movie playback, where the movie itself
+// determines timing.
+void TargetKbd::setExactTiming(bool on) {
+    exact = on;
 }
 
 //
 bool TargetKbd::handleSpecial(uint8_t key, KeyAction a) {
-    if (isSpecial(key)) {
-        uint8_t ix = key & ~K_SPECIAL;
-        DPRINTLN("[TRGT] special " + String(key) + " @ " + String(ix));
-        if (ix < END_OF_COMBOS) {
-            handleCombo(SPECIALS[ix], a);
-        } else if (ix > END_OF_COMBOS && a == RELEASE_KEY) {
-            handleMacro(SPECIALS[ix]);
-        }
-        return true;
+
+    if ((key & K_SPECIAL) == 0) {
+        return false;
     }
-    return false;
+
+    uint8_t ix = key & ~K_SPECIAL;
+    DPRINTLN("[TRGT] special " + String(key) + " @ " + String(ix));
+
+    if (ix < END_OF_COMBOS) {
+        handleCombo(ix, a);
+    } else if (a == RELEASE_KEY) {
+        handleMacro(ix - END_OF_COMBOS - 1);
+    }
+
+    return true;
 }
 
-//
-void TargetKbd::handleCombo(uint8_t combo[], KeyAction a) {
+// Handles combo with index `ix`. When pressed, only its modifier is pressed
+// right away, and the other keys `TIMING.comboDelay` later from `process`.
+// A combo that is still pending is completed before handling the next one.
+void TargetKbd::handleCombo(uint8_t ix, KeyAction a) {
 
     DPRINT("[TRGT] combo");
-    bool toggle = combo[0] == TOGGLE;
-    int ix = 0;
 
-    if (toggle) {
+    completeCombo();
+
+    const uint8_t *entry = COMBOS::table + ix * COMBO_STRIDE;
+
+    if ((pgm_read_byte(entry) & COMBO_TOGGLE) != 0) {
         DPRINTLN(" (toggle)");
-        a = a == PRESS_KEY ? FLIP_KEY : a;
-        ix = 1;
+        if (a == RELEASE_KEY) {
+            return;
+        }
+        a = FLIP_KEY;
+        settleDue = millis() + TIMING.toggleSettle;
     } else {
         DPRINTLN();
     }
 
-    for (; combo[ix] != NA; ix++) {
-        if (a != RELEASE_KEY) {
-            handleKey(combo[ix], a);
-        }
+    uint8_t modifier = pgm_read_byte(entry + 1);
+
+    if (a == PRESS_KEY && modifier != NA && TIMING.comboDelay > 0) {
+        holdSwitch(modifier & K_MASK_AX, (modifier & K_MASK_AY) >> 4, a);
+        comboPending = ix;
+        comboDue = millis() + TIMING.comboDelay;
+        return;
     }
 
-    if (!toggle && a == RELEASE_KEY) {
-        for (ix = ix - 1; ix >= 0 ; ix--) {
-            handleKey(combo[ix], a);
+    applyCombo(ix, a, NA);
+}
+
+// Applies the precomputed masks of combo with index `ix` to the keyboard
+// matrix, except for key `skip`. This takes a hold on each switch of the
+// combo, so switches shared with other combos or keys stay closed until
+// their last holder lets go.
+void TargetKbd::applyCombo(uint8_t ix, KeyAction a, uint8_t skip) {
+
+    const uint8_t *masks = COMBOS::table + ix * COMBO_STRIDE + 2;
+
+    for (uint8_t ax = 0; ax < SwitchChip::AX_LINES; ax++) {
+        uint8_t m = pgm_read_byte(masks + ax);
+        if (skip != NA && ax == (skip & K_MASK_AX)) {
+            m &= ~(1 << ((skip & K_MASK_AY) >> 4));
+        }
+        for (uint8_t ay = 0; m != 0; ay++, m >>= 1) {
+            if ((m & 1) != 0) {
+                holdSwitch(ax, ay, a);
+            }
         }
     }
 }
 
-//
-void TargetKbd::handleMacro(uint8_t macro[]) {
-    DPRINTLN("[TRGT] macro");
-    uint8_t k;
-    for (int ix = 0; ; ix++) {
-        k = macro[ix];
-        if (k == NA) {
-            break;
-        }
-        handleKey(k, PRESS_KEY);
-        delay(MACRO_DELAY_PRESS);
-        handleKey(k, RELEASE_KEY);
-        delay(MACRO_DELAY_RELEASE);
+// Presses the remaining keys of a pending combo. The minimum hold time of the
+// modifier is restarted, so that it does not open before the other keys.
+void TargetKbd::completeCombo() {
+
+    if (comboPending == NA) {
+        return;
+    }
+
+    uint8_t ix = comboPending;
+    uint8_t modifier = pgm_read_byte(COMBOS::table + ix * COMBO_STRIDE + 1);
+    uint8_t ax = modifier & K_MASK_AX;
+    uint8_t ay = (modifier & K_MASK_AY) >> 4;
+
+    comboPending = NA;
+    applyCombo(ix, PRESS_KEY, modifier);
+
+    if ((switchMatrix[ax] & (1 << ay)) != 0) {
+        changedAt[(ax << 3) | ay] = millis();
+        youngMatrix[ax] |= 1 << ay;
+        young = true;
+    }
+}
+
+// starts playing macro with given index from the flattened macro table
+void TargetKbd::handleMacro(uint8_t m) {
+    const uint8_t *entry = MACROS::table + m * MACRO_STRIDE;
+    playMacro(entry + 1, pgm_read_byte(entry), true);
+}
+
+// Starts playing given keys. A `modifier` is pressed before the first key,
+// and released together with the last.
+void TargetKbd::playMacro(const uint8_t keys[], uint8_t len, bool inFlash,
+    uint8_t modifier) {
+    if (isPlaying()) {
+        DPRINTLN("[TRGT] macro already playing, ignoring");
+        return;
     }
+    DPRINTLN("[TRGT] macro");
+    macro = keys;
+    macroInFlash = inFlash;
+    macroLen = len;
+    macroIx = 0;
+    macroKeyDown = false;
+    macroModifier = modifier;
+    macroModifierDown = false;
+    macroHeld = NA;
+    macroDue = millis();
 }
 
 //
-bool TargetKbd::isValidKeyAddress(uint8_t key) {
-    return key < K_SPECIAL;
+void TargetKbd::stopMacro() {
+    macro = NULL;
+    macroKeyDown = false;
+    macroHeld = NA;
 }
 
+//
+bool TargetKbd::isPlaying() {
+    return macro != NULL;
+}
+
+// Whether a combo is pending or a toggle is still settling. Key events should
+// not be handed to us until this clears.
+bool TargetKbd::isBusy() {
+    return comboPending != NA || (long)(millis() - settleDue) < 0;
+}
 
 //
-bool TargetKbd::isValidAxAy(uint8_t ax, uint8_t ay) {
-    if (ax >= array_len(kbdMatrix)) {
-        DPRINTLN("[TRGT] matrix AX out of bounds: " + String(ax));
+uint8_t TargetKbd::getMacroKey() {
+    return macroInFlash ? pgm_read_byte(macro + macroIx) : macro[macroIx];
+}
+
+// Completes pending combos, applies switch changes that were held back by
+// the timing profile, and advances macro playback by at most one step, once
+// the delay of the previous step has passed. A step presses or releases a
+// single key. When `canOverlap` permits, the next key is pressed while the
+// current one is still held, and the current one is released on the step
+// after that, so both are closed together for at least `minHold`. Needs to be
+// called from the main loop.
+void TargetKbd::process() {
+
+    if (comboPending != NA && (long)(millis() - comboDue) >= 0) {
+        completeCombo();
+        commit();
+    } else if (young) {
+        commit();
+    }
+
+    if (dirty && (!isSynced() || sync->scanDone())) {
+        apply();
+    }
+
+    mt88xx.flush(); // actions the output stage had no room for yet
+
+    if (!isPlaying() || isBusy() || (long)(millis() - macroDue) < 0) {
+        return;
+    }
+
+    if (macroHeld != NA) { // overlap done, release previous key
+        handleKey(macroHeld, RELEASE_KEY);
+        macroHeld = NA;
+
+    } else if (macroKeyDown) {
+        uint8_t prev = getMacroKey();
+        macroIx++;
+        if (macroIx < macroLen && canOverlap(prev, getMacroKey())
+            && !isRepeat(getMacroKey())) {
+            // press next key while this one is still held
+            handleKey(getMacroKey(), PRESS_KEY);
+            macroHeld = prev;
+            macroDue = millis() + minHold();
+        } else {
+            updateKey(prev, RELEASE_KEY);
+            if (macroIx == macroLen && macroModifierDown) {
+                updateKey(macroModifier, RELEASE_KEY);
+                macroModifierDown = false;
+            }
+            commit();
+            macroKeyDown = false;
+            macroDue = millis() + minGap();
+        }
+
+    } else if (macroIx == macroLen) {
+        DPRINTLN("[TRGT] macro done");
+        stopMacro();
+
+    } else if (isRepeat(getMacroKey())) {
+        return; // target still sees the key as held, try again later
+
+    } else if (macroModifier != NA && macroIx == 0 && !macroModifierDown) {
+        handleKey(macroModifier, PRESS_KEY);
+        macroModifierDown = true;
+        macroDue = millis() + TIMING.comboDelay;
+
+    } else {
+        handleKey(getMacroKey(), PRESS_KEY);
+        macroKeyDown = true;
+        macroDue = millis() + minHold();
+    }
+}
+
+// AY bit mask of the switch plain key `k` closes on AX line `ax`
+uint8_t TargetKbd::keyMask(uint8_t k, uint8_t ax) {
+    return (k & K_MASK_AX) == ax ? 1 << ((k & K_MASK_AY) >> 4) : 0;
+}
+
+// Whether plain key `k` is a shift key of the target, i.e. the modifier of
+// any combo.
+bool TargetKbd::isShiftKey(uint8_t k) {
+    for (uint8_t ix = 0; ix < END_OF_COMBOS; ix++) {
+        if (pgm_read_byte(COMBOS::table + ix * COMBO_STRIDE + 1) == k) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether pressing key `k` closes a switch of a main key, i.e. not of a shift
+// key, that opened less than `TIMING.repeatGap` ago. The target would still
+// consider that key held and ignore the new press, e.g. the Spectrum ROM only
+// forgets a released key after five frames.
+bool TargetKbd::isRepeat(uint8_t k) {
+
+    if (TIMING.repeatGap == 0 || k == NA) {
         return false;
     }
-    if (ay > 7) {
-        DPRINTLN("[TRGT] matrix AY out of bounds: " + String(ay));
+
+    uint8_t m[SwitchChip::AX_LINES];
+    uint8_t ix = k & ~K_SPECIAL;
+
+    if ((k & K_SPECIAL) == 0) {
+        if (isShiftKey(k)) {
+            return false;
+        }
+        for (uint8_t ax = 0; ax < SwitchChip::AX_LINES; ax++) {
+            m[ax] = keyMask(k, ax);
+        }
+    } else if (ix < END_OF_COMBOS) {
+        const uint8_t *entry = COMBOS::table + ix * COMBO_STRIDE;
+        uint8_t modifier = pgm_read_byte(entry + 1);
+        for (uint8_t ax = 0; ax < SwitchChip::AX_LINES; ax++) {
+            m[ax] = pgm_read_byte(entry + 2 + ax);
+            if (modifier != NA) {
+                m[ax] &= ~keyMask(modifier, ax);
+            }
+        }
+    } else {
         return false;
     }
-    return true;
+
+    uint8_t now = millis();
+
+    for (uint8_t ax = 0; ax < SwitchChip::AX_LINES; ax++) {
+        uint8_t bits = m[ax] & youngMatrix[ax] & ~switchMatrix[ax];
+        for (uint8_t ay = 0; bits != 0; ay++, bits >>= 1) {
+            if ((bits & 1) != 0
+                && (uint8_t)(now - changedAt[(ax << 3) | ay])
+                    < TIMING.repeatGap) {
+                return true;
+            }
+        }
+    }
+
+    return false;
 }
 
-//
-void TargetKbd::setKeyState(uint8_t ax, uint8_t ay, bool on) {
-    if (isValidAxAy(ax, ay)) {
-        if (on) {
-            kbdMatrix[ax] = kbdMatrix[ax] | (1 << ay);
-        } else {
-            kbdMatrix[ax] = kbdMatrix[ax] & (~(1 << ay));
+// Whether key `next` may be pressed while key `prev` is still held. Only
+// plain keys other than shift keys may overlap, since the target would
+// otherwise read the other key as shifted, e.g. `b` pressed while SYMBOL
+// SHIFT is still held from a combo becomes `*` on the Spectrum. The keys
+// must not share any switch, since the target would then not see two
+// separate presses, and together with all other closed switches they must
+// not create a ghost key.
+bool TargetKbd::canOverlap(uint8_t prev, uint8_t next) {
+
+    if (!isPlainKey(prev) || !isPlainKey(next)
+        || isShiftKey(prev) || isShiftKey(next)) {
+        return false;
+    }
+
+    uint8_t m[SwitchChip::AX_LINES];
+
+    for (uint8_t ax = 0; ax < SwitchChip::AX_LINES; ax++) {
+        uint8_t n = keyMask(next, ax);
+        if ((keyMask(prev, ax) & n) != 0) {
+            return false;
+        }
+        m[ax] = kbdMatrix[ax] | switchMatrix[ax] | pendingMatrix[ax] | n;
+    }
+
+    return !hasGhost(m);
+}
+
+// Target keyboards have no diodes, so when three closed switches form three
+// corners of a rectangle, the target also sees the key at the fourth corner.
+// This happens exactly when two AX lines share an AY line, but not all of
+// them.
+bool TargetKbd::hasGhost(const uint8_t m[]) {
+    for (uint8_t a = 0; a < SwitchChip::AX_LINES; a++) {
+        for (uint8_t b = a + 1; b < SwitchChip::AX_LINES; b++) {
+            if ((m[a] & m[b]) != 0 && m[a] != m[b]) {
+                return true;
+            }
         }
     }
+    return false;
 }
 
 //
-bool TargetKbd::getKeyState(uint8_t ax, uint8_t ay) {
-    if (isValidAxAy(ax, ay)) {
-        return (kbdMatrix[ax] & (1 << ay)) != 0;
+void TargetKbd::setKeyState(uint8_t ax, uint8_t ay, bool on) {
+    if (on) {
+        kbdMatrix[ax] = kbdMatrix[ax] | (1 << ay);
+    } else {
+        kbdMatrix[ax] = kbdMatrix[ax] & (~(1 << ay));
     }
-    return false;
 }
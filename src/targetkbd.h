@@ -20,35 +20,97 @@
 #include <Arduino.h>
 
 #include "config.h"
+#include "framesync.h"
 #include "mt88xx.h"
+#include "tables.h"
 
 //
 class TargetKbd {
 
 private:
-    MT88xx mt88xx;
-    // This bit matrix represents the current state of the target keyboard.
-    // A key is pressed when its corresponding bit is 0.
-    uint8_t kbdMatrix[16];
+    SwitchChip mt88xx;
+    FrameSync *sync;
+    // This bit matrix represents the desired state of the target keyboard,
+    // one AY bit mask per AX line. A key is pressed when its corresponding
+    // bit is 1. Changes are collected here and then committed to the switch
+    // chip in one go.
+    uint8_t kbdMatrix[SwitchChip::AX_LINES];
+    // the state that was last committed to the switch chip
+    uint8_t switchMatrix[SwitchChip::AX_LINES];
+    // Number of holders per switch, at index `ax * 8 + ay`. Sources and
+    // combos pressing the same switch each add a hold, and the switch only
+    // opens when the last hold is released. A latched toggle counts as one
+    // hold, and is marked in `latchMatrix`.
+    uint8_t holds[SwitchChip::AX_LINES * 8];
+    uint8_t latchMatrix[SwitchChip::AX_LINES];
+    // Lower byte of `millis` when each switch last changed, at index
+    // `ax * 8 + ay`. Opening a switch is held back until it has been closed
+    // for `minHold`, so the target sees even the shortest taps, and closing
+    // it until it has been open for `minGap`. Switches that changed within
+    // the largest of both times and `TIMING.repeatGap` are marked in
+    // `youngMatrix`, and deferred closes in `pendingMatrix`.
+    uint8_t changedAt[SwitchChip::AX_LINES * 8];
+    uint8_t youngMatrix[SwitchChip::AX_LINES];
+    uint8_t pendingMatrix[SwitchChip::AX_LINES];
+    bool young;             // any switch in `youngMatrix`
+    bool dirty;             // commit waiting for end of scan
+    bool exact;             // no hold and gap times, see `setExactTiming`
+
+    // combo whose modifier has been pressed, but not yet its other keys
+    uint8_t comboPending;
+    unsigned long comboDue; // `millis` time stamp for pressing other keys
+    unsigned long settleDue; // `millis` time stamp when a toggle has settled
+
+    // macro player state; a macro is played one step at a time from within
+    // `process`, so the main loop keeps servicing all other sources
+    const uint8_t *macro;
+    bool macroInFlash;      // macros from target header are in flash
+    uint8_t macroLen;
+    uint8_t macroIx;
+    bool macroKeyDown;
+    uint8_t macroHeld;      // previous key held during overlap, `NA` if none
+    uint8_t macroModifier;  // held while playing, `NA` if none
+    bool macroModifierDown;
+    unsigned long macroDue; // `millis` time stamp of next step
+    uint8_t typed;          // one key macro used by `typeKey`
 
     void clearKeyboardMatrix();
-    bool isSpecial(uint8_t key);
-    bool isValidKeyAddress(uint8_t key);
-    bool isValidAxAy(uint8_t ax, uint8_t ay);
+    void apply();
+    bool isSynced();
+    uint8_t minHold();
+    uint8_t minGap();
+    uint8_t atLeastHalfScan(uint8_t ms);
     void setKeyState(uint8_t ax, uint8_t ay, bool on);
-    bool getKeyState(uint8_t ax, uint8_t ay);
+    void holdSwitch(uint8_t ax, uint8_t ay, KeyAction a);
     bool handleSpecial(uint8_t key, KeyAction a);
-    void handleCombo(uint8_t combo[], KeyAction a);
-    void handleMacro(uint8_t macro[]);
+    void handleCombo(uint8_t ix, KeyAction a);
+    void applyCombo(uint8_t ix, KeyAction a, uint8_t skip);
+    void completeCombo();
+    void handleMacro(uint8_t m);
+    void playMacro(const uint8_t keys[], uint8_t len, bool inFlash,
+        uint8_t modifier = NA);
+    void stopMacro();
+    uint8_t getMacroKey();
+    uint8_t keyMask(uint8_t k, uint8_t ax);
+    bool isShiftKey(uint8_t k);
+    bool isRepeat(uint8_t k);
+    bool canOverlap(uint8_t prev, uint8_t next);
+    bool hasGhost(const uint8_t m[]);
 
 public:
-    TargetKbd();
+    TargetKbd(FrameSync *s);
     void reset();
-    void typeKey(uint8_t key);
+    void process();
+    bool isPlaying();
+    bool isBusy();
+    void setExactTiming(bool on);
+    void typeKey(uint8_t key, uint8_t modifier = NA);
     void flipKey(uint8_t key);
     void pressKey(uint8_t key);
     void releaseKey(uint8_t key);
     void handleKey(uint8_t k, KeyAction a);
+    void updateKey(uint8_t k, KeyAction a);
+    void commit();
 };
 
 #endif
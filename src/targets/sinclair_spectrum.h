@@ -93,6 +93,35 @@ static const uint8_t K_ENTER  = B0000110;
 static const uint8_t K_SPACE  = B0000111;
 static const uint8_t K_SYMBOL = B0010111;
 
+/* --- timing -----------------------------------------------------------------
+
+    The timing profile tells how fast keys may be operated on the target, in
+    ms. All values need to be lower than 256. The Spectrum scans its keyboard
+    in the 50 Hz frame interrupt, i.e. every 20 ms. A key that is released
+    again before the next scan is never seen, so releasing a switch is held
+    back until it has been closed for `minHold`. Likewise, a switch needs to
+    stay open for `minGap` before it closes again, or two presses of the same
+    key merge into one. The ROM however only forgets a released key after five
+    frames, and ignores it when pressed again before that. So when typing text
+    or playing macros, a key is pressed again only when it has been released
+    for `repeatGap`. The shift keys are exempt. This is not applied to
+    joystick and other direct input, since games usually read the keyboard
+    ports themselves. For combos, the modifier (the first key of a combo) is
+    pressed `comboDelay` before the other keys, so that the ROM sees the
+    modifier first. After a toggle, the next key is handled `toggleSettle`
+    later. Macros are played at the same pace. `framePeriod` is the length of
+    a frame in µs, which is used for counting frames during movie playback
+    when there's no frame sync signal (see config.h).
+ */
+static constexpr TimingProfile TIMING = {
+    25,     // minHold
+    25,     // minGap
+    120,    // repeatGap, six frames
+    10,     // comboDelay
+    50,     // toggleSettle
+    19968   // framePeriod, 69888 T-states at 3.5 MHz
+};
+
 /* --- specials ---------------------------------------------------------------
 
     This enumeration provides the index numbers for combos & macros.
@@ -125,31 +154,33 @@ enum SPECIALS {
 /* --- combo definitions ------------------------------------------------------
 
     Each combo defines the keys that should be pressed/released on the target
-    when the combo is used. When pressing, keys are pressed in order left to
-    right, when releasing right to left.
+    when the combo is used. All keys of a combo are committed to the switch
+    matrix together, in a single update. Combos need to be `constexpr`, since
+    the compiler turns them into bit masks for the switch matrix (see
+    tables.h). A combo can only contain plain keys, no other specials.
 
-    Note that it is required to terminate each combo with `NA`! Failure to do
-    so will result in crashes.
+    Note that it is required to terminate each combo with `NA`! Compilation
+    fails otherwise.
  */
-static const uint8_t combo_period[]       = {K_SYMBOL, K_M, NA};
-static const uint8_t combo_comma[]        = {K_SYMBOL, K_N, NA};
-static const uint8_t combo_semicolon[]    = {K_SYMBOL, K_O, NA};
-static const uint8_t combo_slash[]        = {K_SYMBOL, K_V, NA};
-static const uint8_t combo_asterisk[]     = {K_SYMBOL, K_B, NA};
-static const uint8_t combo_plus[]         = {K_SYMBOL, K_K, NA};
-static const uint8_t combo_minus[]        = {K_SYMBOL, K_J, NA};
-static const uint8_t combo_quote[]        = {K_SYMBOL, K_7, NA};
-static const uint8_t combo_double_quote[] = {K_SYMBOL, K_P, NA};
-static const uint8_t combo_equal[]        = {K_SYMBOL, K_L, NA};
-static const uint8_t combo_underscore[]   = {K_SYMBOL, K_0, NA};
-static const uint8_t combo_delete[]       = {K_CAPS, K_0, NA};
-static const uint8_t combo_up[]           = {K_CAPS, K_7, NA};
-static const uint8_t combo_down[]         = {K_CAPS, K_6, NA};
-static const uint8_t combo_left[]         = {K_CAPS, K_5, NA};
-static const uint8_t combo_right[]        = {K_CAPS, K_8, NA};
-static const uint8_t combo_extended[]     = {K_SYMBOL, K_CAPS, NA};
+static constexpr uint8_t combo_period[]       PROGMEM = {K_SYMBOL, K_M, NA};
+static constexpr uint8_t combo_comma[]        PROGMEM = {K_SYMBOL, K_N, NA};
+static constexpr uint8_t combo_semicolon[]    PROGMEM = {K_SYMBOL, K_O, NA};
+static constexpr uint8_t combo_slash[]        PROGMEM = {K_SYMBOL, K_V, NA};
+static constexpr uint8_t combo_asterisk[]     PROGMEM = {K_SYMBOL, K_B, NA};
+static constexpr uint8_t combo_plus[]         PROGMEM = {K_SYMBOL, K_K, NA};
+static constexpr uint8_t combo_minus[]        PROGMEM = {K_SYMBOL, K_J, NA};
+static constexpr uint8_t combo_quote[]        PROGMEM = {K_SYMBOL, K_7, NA};
+static constexpr uint8_t combo_double_quote[] PROGMEM = {K_SYMBOL, K_P, NA};
+static constexpr uint8_t combo_equal[]        PROGMEM = {K_SYMBOL, K_L, NA};
+static constexpr uint8_t combo_underscore[]   PROGMEM = {K_SYMBOL, K_0, NA};
+static constexpr uint8_t combo_delete[]       PROGMEM = {K_CAPS, K_0, NA};
+static constexpr uint8_t combo_up[]           PROGMEM = {K_CAPS, K_7, NA};
+static constexpr uint8_t combo_down[]         PROGMEM = {K_CAPS, K_6, NA};
+static constexpr uint8_t combo_left[]         PROGMEM = {K_CAPS, K_5, NA};
+static constexpr uint8_t combo_right[]        PROGMEM = {K_CAPS, K_8, NA};
+static constexpr uint8_t combo_extended[]     PROGMEM = {K_SYMBOL, K_CAPS, NA};
 // when the first element is `TOGGLE`, the combo is handled as a toggle key
-static const uint8_t combo_caps_lock[]    = {TOGGLE, K_CAPS, NA};
+static constexpr uint8_t combo_caps_lock[]    PROGMEM = {TOGGLE, K_CAPS, NA};
 
 /* --- macro definitions ------------------------------------------------------
 
@@ -158,10 +189,10 @@ static const uint8_t combo_caps_lock[]    = {TOGGLE, K_CAPS, NA};
     one, from left to right. Combos can be used in a macro. Use the `SK`
     preprocessor macro to reference them.
 
-    Note that it is required to terminate each macro with `NA`! Failure to do
-    so will result in crashes.
+    Note that it is required to terminate each macro with `NA`! Compilation
+    fails otherwise.
  */
-static const uint8_t macro_format_serial[] = {
+static constexpr uint8_t macro_format_serial[] PROGMEM = {
     SK(COMBO_EXTENDED), SK(COMBO_UNDERSCORE),   // FORMAT
     SK(COMBO_DOUBLE_QUOTE),                     // "
     K_B,                                        // b
@@ -171,7 +202,7 @@ static const uint8_t macro_format_serial[] = {
     NA
 };
 
-static const uint8_t macro_load_serial[] = {
+static constexpr uint8_t macro_load_serial[] PROGMEM = {
     K_J,                                        // LOAD
     SK(COMBO_ASTERISK),                         // *
     SK(COMBO_DOUBLE_QUOTE),                     // "
@@ -183,30 +214,33 @@ static const uint8_t macro_load_serial[] = {
 /* --- specials table ---------------------------------------------------------
 
     This table aggregates all combos & macros that should be used. The order
-    needs to exactly follow the `SPECIALS` enumeration above.
+    needs to exactly follow the `SPECIALS` enumeration above, which is why
+    each entry repeats its enumeration value. The compiler checks this, and
+    all other rules given in this file. The table is only used at compile
+    time, for generating the flat combo & macro tables in tables.h.
  */
-static const uint8_t* SPECIALS[END_OF_SPECIALS] = {
-    combo_period,
-    combo_comma,
-    combo_semicolon,
-    combo_slash,
-    combo_asterisk,
-    combo_plus,
-    combo_minus,
-    combo_quote,
-    combo_double_quote,
-    combo_equal,
-    combo_underscore,
-    combo_delete,
-    combo_up,
-    combo_down,
-    combo_left,
-    combo_right,
-    combo_extended,
-    combo_caps_lock,
-    0, // combo/macro divider
-    macro_format_serial,
-    macro_load_serial
+static constexpr Special SPECIALS[END_OF_SPECIALS] = {
+    {COMBO_PERIOD,         combo_period},
+    {COMBO_COMMA,          combo_comma},
+    {COMBO_SEMICOLON,      combo_semicolon},
+    {COMBO_SLASH,          combo_slash},
+    {COMBO_ASTERISK,       combo_asterisk},
+    {COMBO_PLUS,           combo_plus},
+    {COMBO_MINUS,          combo_minus},
+    {COMBO_QUOTE,          combo_quote},
+    {COMBO_DOUBLE_QUOTE,   combo_double_quote},
+    {COMBO_EQUAL,          combo_equal},
+    {COMBO_UNDERSCORE,     combo_underscore},
+    {COMBO_DELETE,         combo_delete},
+    {COMBO_UP,             combo_up},
+    {COMBO_DOWN,           combo_down},
+    {COMBO_LEFT,           combo_left},
+    {COMBO_RIGHT,          combo_right},
+    {COMBO_EXTENDED,       combo_extended},
+    {COMBO_CAPS_LOCK,      combo_caps_lock},
+    {END_OF_COMBOS,        NULL}, // combo/macro divider
+    {MACRO_FORMAT_SERIAL,  macro_format_serial},
+    {MACRO_LOAD_SERIAL,    macro_load_serial}
 };
 
 /* --- key map ----------------------------------------------------------------
@@ -217,9 +251,13 @@ static const uint8_t* SPECIALS[END_OF_SPECIALS] = {
 
     Note that since bit 7 is used to distinguish between plain keys (0) and
     special keys (1), i.e. combos & macros, the size of this table must not
-    exceed 128.
+    exceed 128. Also, all keys used here and in combos & macros need to fit
+    the MT88xx chip selected in config.h.
+
+    All tables in this file, including combos & macros, are placed in flash
+    via `PROGMEM`, so they don't take up any of the scarce RAM.
  */
-static const uint8_t MAP_INPUT_TO_TARGET[] = {
+static constexpr uint8_t MAP_INPUT_TO_TARGET[] PROGMEM = {
     NA,                 // KEY_RESERVED
     NA,                 // KEY_ESC
     K_1,                // KEY_1
@@ -331,4 +369,115 @@ static const uint8_t MAP_INPUT_TO_TARGET[] = {
     SK(COMBO_DOWN),     // KEY_DOWN
 };
 
+/* --- text map ---------------------------------------------------------------
+
+    This map translates printable ASCII characters (`' '` to `'~'`) to target
+    keys, for text sent to the text engine via the serial port (see README).
+    The character minus `' '` is used as index into this table. Each entry
+    gives a modifier that is held while typing the key, and the key itself,
+    which may also be a combo. Characters that can't be typed on the target
+    are `{NA, NA}`. `TEXT_NEWLINE` is used for line feeds. Which character
+    actually appears on the target may depend on its current input mode, e.g.
+    the Spectrum turns letters into keywords in `K` mode.
+ */
+static constexpr TextKey MAP_TEXT_TO_TARGET[] PROGMEM = {
+    {NA,       K_SPACE},                // ' '
+    {K_SYMBOL, K_1},                    // '!'
+    {NA,       SK(COMBO_DOUBLE_QUOTE)}, // '"'
+    {K_SYMBOL, K_3},                    // '#'
+    {K_SYMBOL, K_4},                    // '$'
+    {K_SYMBOL, K_5},                    // '%'
+    {K_SYMBOL, K_6},                    // '&'
+    {NA,       SK(COMBO_QUOTE)},        // '''
+    {K_SYMBOL, K_8},                    // '('
+    {K_SYMBOL, K_9},                    // ')'
+    {NA,       SK(COMBO_ASTERISK)},     // '*'
+    {NA,       SK(COMBO_PLUS)},         // '+'
+    {NA,       SK(COMBO_COMMA)},        // ','
+    {NA,       SK(COMBO_MINUS)},        // '-'
+    {NA,       SK(COMBO_PERIOD)},       // '.'
+    {NA,       SK(COMBO_SLASH)},        // '/'
+    {NA,       K_0},                    // '0'
+    {NA,       K_1},                    // '1'
+    {NA,       K_2},                    // '2'
+    {NA,       K_3},                    // '3'
+    {NA,       K_4},                    // '4'
+    {NA,       K_5},                    // '5'
+    {NA,       K_6},                    // '6'
+    {NA,       K_7},                    // '7'
+    {NA,       K_8},                    // '8'
+    {NA,       K_9},                    // '9'
+    {K_SYMBOL, K_Z},                    // ':'
+    {NA,       SK(COMBO_SEMICOLON)},    // ';'
+    {K_SYMBOL, K_R},                    // '<'
+    {NA,       SK(COMBO_EQUAL)},        // '='
+    {K_SYMBOL, K_T},                    // '>'
+    {K_SYMBOL, K_C},                    // '?'
+    {K_SYMBOL, K_2},                    // '@'
+    {K_CAPS,   K_A},                    // 'A'
+    {K_CAPS,   K_B},                    // 'B'
+    {K_CAPS,   K_C},                    // 'C'
+    {K_CAPS,   K_D},                    // 'D'
+    {K_CAPS,   K_E},                    // 'E'
+    {K_CAPS,   K_F},                    // 'F'
+    {K_CAPS,   K_G},                    // 'G'
+    {K_CAPS,   K_H},                    // 'H'
+    {K_CAPS,   K_I},                    // 'I'
+    {K_CAPS,   K_J},                    // 'J'
+    {K_CAPS,   K_K},                    // 'K'
+    {K_CAPS,   K_L},                    // 'L'
+    {K_CAPS,   K_M},                    // 'M'
+    {K_CAPS,   K_N},                    // 'N'
+    {K_CAPS,   K_O},                    // 'O'
+    {K_CAPS,   K_P},                    // 'P'
+    {K_CAPS,   K_Q},                    // 'Q'
+    {K_CAPS,   K_R},                    // 'R'
+    {K_CAPS,   K_S},                    // 'S'
+    {K_CAPS,   K_T},                    // 'T'
+    {K_CAPS,   K_U},                    // 'U'
+    {K_CAPS,   K_V},                    // 'V'
+    {K_CAPS,   K_W},                    // 'W'
+    {K_CAPS,   K_X},                    // 'X'
+    {K_CAPS,   K_Y},                    // 'Y'
+    {K_CAPS,   K_Z},                    // 'Z'
+    {NA,       NA},                     // '['
+    {NA,       NA},                     // '\\'
+    {NA,       NA},                     // ']'
+    {K_SYMBOL, K_H},                    // '^'
+    {NA,       SK(COMBO_UNDERSCORE)},   // '_'
+    {NA,       NA},                     // '`'
+    {NA,       K_A},                    // 'a'
+    {NA,       K_B},                    // 'b'
+    {NA,       K_C},                    // 'c'
+    {NA,       K_D},                    // 'd'
+    {NA,       K_E},                    // 'e'
+    {NA,       K_F},                    // 'f'
+    {NA,       K_G},                    // 'g'
+    {NA,       K_H},                    // 'h'
+    {NA,       K_I},                    // 'i'
+    {NA,       K_J},                    // 'j'
+    {NA,       K_K},                    // 'k'
+    {NA,       K_L},                    // 'l'
+    {NA,       K_M},                    // 'm'
+    {NA,       K_N},                    // 'n'
+    {NA,       K_O},                    // 'o'
+    {NA,       K_P},                    // 'p'
+    {NA,       K_Q},                    // 'q'
+    {NA,       K_R},                    // 'r'
+    {NA,       K_S},                    // 's'
+    {NA,       K_T},                    // 't'
+    {NA,       K_U},                    // 'u'
+    {NA,       K_V},                    // 'v'
+    {NA,       K_W},                    // 'w'
+    {NA,       K_X},                    // 'x'
+    {NA,       K_Y},                    // 'y'
+    {NA,       K_Z},                    // 'z'
+    {NA,       NA},                     // '{'
+    {NA,       NA},                     // '|'
+    {NA,       NA},                     // '}'
+    {NA,       NA}                      // '~'
+};
+
+static constexpr TextKey TEXT_NEWLINE = {NA, K_ENTER};
+
 #endif
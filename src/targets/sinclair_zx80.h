@@ -19,6 +19,19 @@
 
 #include "targets/sinclair_zx8x_base.h"
 
+// --- timing -----------------------------------------------------------------
+
+// timing profile (see sinclair_spectrum.h); the ZX80 only reads its keyboard
+// in between generating display frames, so this is slower than on the ZX81
+static constexpr TimingProfile TIMING = {
+    40,     // minHold
+    40,     // minGap
+    0,      // repeatGap, `minGap` suffices
+    20,     // comboDelay
+    100,    // toggleSettle
+    20000   // framePeriod
+};
+
 // --- specials ---------------------------------------------------------------
 enum SPECIALS {
     COMBO_LEFT = 0,
@@ -52,45 +65,45 @@ enum SPECIALS {
 };
 
 // combo definitions
-static const uint8_t combo_home[]         = {K_SHIFT, K_9, NA};
-static const uint8_t combo_double_quote[] = {K_SHIFT, K_Y, NA};
-static const uint8_t combo_asterisk[]     = {K_SHIFT, K_P, NA};
-static const uint8_t combo_edit[]         = {K_SHIFT, K_NEWLINE, NA};
+static constexpr uint8_t combo_home[]         PROGMEM = {K_SHIFT, K_9, NA};
+static constexpr uint8_t combo_double_quote[] PROGMEM = {K_SHIFT, K_Y, NA};
+static constexpr uint8_t combo_asterisk[]     PROGMEM = {K_SHIFT, K_P, NA};
+static constexpr uint8_t combo_edit[]         PROGMEM = {K_SHIFT, K_NEWLINE, NA};
 
 // macro definitions
-static const uint8_t macro_load[] = { // LOAD ""
+static constexpr uint8_t macro_load[] PROGMEM = { // LOAD ""
     K_W, SK(COMBO_DOUBLE_QUOTE), SK(COMBO_DOUBLE_QUOTE), NA
 };
 
 // specials table
-static const uint8_t* SPECIALS[END_OF_SPECIALS] = {
-    combo_left,
-    combo_down,
-    combo_up,
-    combo_right,
-    combo_home,
-    combo_rubout,
-    combo_double_quote,
-    combo_dollar,
-    combo_open_paren,
-    combo_close_paren,
-    combo_asterisk,
-    combo_exp,
-    combo_minus,
-    combo_plus,
-    combo_equal,
-    combo_edit,
-    combo_caps_lock,
-    combo_colon,
-    combo_semicolon,
-    combo_question,
-    combo_slash,
-    combo_lower,
-    combo_greater,
-    combo_comma,
-    combo_pound,
-    0, // combo/macro divider
-    macro_load
+static constexpr Special SPECIALS[END_OF_SPECIALS] = {
+    {COMBO_LEFT,          combo_left},
+    {COMBO_DOWN,          combo_down},
+    {COMBO_UP,            combo_up},
+    {COMBO_RIGHT,         combo_right},
+    {COMBO_HOME,          combo_home},
+    {COMBO_RUBOUT,        combo_rubout},
+    {COMBO_DOUBLE_QUOTE,  combo_double_quote},
+    {COMBO_DOLLAR,        combo_dollar},
+    {COMBO_OPEN_PAREN,    combo_open_paren},
+    {COMBO_CLOSE_PAREN,   combo_close_paren},
+    {COMBO_ASTERISK,      combo_asterisk},
+    {COMBO_EXP,           combo_exp},
+    {COMBO_MINUS,         combo_minus},
+    {COMBO_PLUS,          combo_plus},
+    {COMBO_EQUAL,         combo_equal},
+    {COMBO_EDIT,          combo_edit},
+    {COMBO_CAPS_LOCK,     combo_caps_lock},
+    {COMBO_COLON,         combo_colon},
+    {COMBO_SEMICOLON,     combo_semicolon},
+    {COMBO_QUESTION,      combo_question},
+    {COMBO_SLASH,         combo_slash},
+    {COMBO_LOWER,         combo_lower},
+    {COMBO_GREATER,       combo_greater},
+    {COMBO_COMMA,         combo_comma},
+    {COMBO_POUND,         combo_pound},
+    {END_OF_COMBOS,       NULL}, // combo/macro divider
+    {MACRO_LOAD,          macro_load}
 };
 
 /* --- key map ----------------------------------------------------------------
@@ -98,7 +111,7 @@ static const uint8_t* SPECIALS[END_OF_SPECIALS] = {
     map for translating input key codes (see input_keycodes.h) to target key
     addresses
  */
-static const uint8_t MAP_INPUT_TO_TARGET[] = {
+static constexpr uint8_t MAP_INPUT_TO_TARGET[] PROGMEM = {
     NA,                 // KEY_RESERVED
     NA,                 // KEY_ESC
     K_1,                // KEY_1
@@ -213,4 +226,106 @@ static const uint8_t MAP_INPUT_TO_TARGET[] = {
     SK(COMBO_RUBOUT)    // KEY_DELETE
 };
 
+// map for translating printable ASCII characters to target keys, see
+// sinclair_spectrum.h; the ZX8x has no lower case letters
+static constexpr TextKey MAP_TEXT_TO_TARGET[] PROGMEM = {
+    {NA,       K_SPACE},                // ' '
+    {NA,       NA},                     // '!'
+    {NA,       SK(COMBO_DOUBLE_QUOTE)}, // '"'
+    {NA,       NA},                     // '#'
+    {NA,       SK(COMBO_DOLLAR)},       // '$'
+    {NA,       NA},                     // '%'
+    {NA,       NA},                     // '&'
+    {NA,       NA},                     // '''
+    {NA,       SK(COMBO_OPEN_PAREN)},   // '('
+    {NA,       SK(COMBO_CLOSE_PAREN)},  // ')'
+    {NA,       SK(COMBO_ASTERISK)},     // '*'
+    {NA,       SK(COMBO_PLUS)},         // '+'
+    {NA,       SK(COMBO_COMMA)},        // ','
+    {NA,       SK(COMBO_MINUS)},        // '-'
+    {NA,       K_DOT},                  // '.'
+    {NA,       SK(COMBO_SLASH)},        // '/'
+    {NA,       K_0},                    // '0'
+    {NA,       K_1},                    // '1'
+    {NA,       K_2},                    // '2'
+    {NA,       K_3},                    // '3'
+    {NA,       K_4},                    // '4'
+    {NA,       K_5},                    // '5'
+    {NA,       K_6},                    // '6'
+    {NA,       K_7},                    // '7'
+    {NA,       K_8},                    // '8'
+    {NA,       K_9},                    // '9'
+    {NA,       SK(COMBO_COLON)},        // ':'
+    {NA,       SK(COMBO_SEMICOLON)},    // ';'
+    {NA,       SK(COMBO_LOWER)},        // '<'
+    {NA,       SK(COMBO_EQUAL)},        // '='
+    {NA,       SK(COMBO_GREATER)},      // '>'
+    {NA,       SK(COMBO_QUESTION)},     // '?'
+    {NA,       NA},                     // '@'
+    {NA,       K_A},                    // 'A'
+    {NA,       K_B},                    // 'B'
+    {NA,       K_C},                    // 'C'
+    {NA,       K_D},                    // 'D'
+    {NA,       K_E},                    // 'E'
+    {NA,       K_F},                    // 'F'
+    {NA,       K_G},                    // 'G'
+    {NA,       K_H},                    // 'H'
+    {NA,       K_I},                    // 'I'
+    {NA,       K_J},                    // 'J'
+    {NA,       K_K},                    // 'K'
+    {NA,       K_L},                    // 'L'
+    {NA,       K_M},                    // 'M'
+    {NA,       K_N},                    // 'N'
+    {NA,       K_O},                    // 'O'
+    {NA,       K_P},                    // 'P'
+    {NA,       K_Q},                    // 'Q'
+    {NA,       K_R},                    // 'R'
+    {NA,       K_S},                    // 'S'
+    {NA,       K_T},                    // 'T'
+    {NA,       K_U},                    // 'U'
+    {NA,       K_V},                    // 'V'
+    {NA,       K_W},                    // 'W'
+    {NA,       K_X},                    // 'X'
+    {NA,       K_Y},                    // 'Y'
+    {NA,       K_Z},                    // 'Z'
+    {NA,       NA},                     // '['
+    {NA,       NA},                     // '\\'
+    {NA,       NA},                     // ']'
+    {NA,       NA},                     // '^'
+    {NA,       NA},                     // '_'
+    {NA,       NA},                     // '`'
+    {NA,       K_A},                    // 'a'
+    {NA,       K_B},                    // 'b'
+    {NA,       K_C},                    // 'c'
+    {NA,       K_D},                    // 'd'
+    {NA,       K_E},                    // 'e'
+    {NA,       K_F},                    // 'f'
+    {NA,       K_G},                    // 'g'
+    {NA,       K_H},                    // 'h'
+    {NA,       K_I},                    // 'i'
+    {NA,       K_J},                    // 'j'
+    {NA,       K_K},                    // 'k'
+    {NA,       K_L},                    // 'l'
+    {NA,       K_M},                    // 'm'
+    {NA,       K_N},                    // 'n'
+    {NA,       K_O},                    // 'o'
+    {NA,       K_P},                    // 'p'
+    {NA,       K_Q},                    // 'q'
+    {NA,       K_R},                    // 'r'
+    {NA,       K_S},                    // 's'
+    {NA,       K_T},                    // 't'
+    {NA,       K_U},                    // 'u'
+    {NA,       K_V},                    // 'v'
+    {NA,       K_W},                    // 'w'
+    {NA,       K_X},                    // 'x'
+    {NA,       K_Y},                    // 'y'
+    {NA,       K_Z},                    // 'z'
+    {NA,       NA},                     // '{'
+    {NA,       NA},                     // '|'
+    {NA,       NA},                     // '}'
+    {NA,       NA}                      // '~'
+};
+
+static constexpr TextKey TEXT_NEWLINE = {NA, K_NEWLINE};
+
 #endif
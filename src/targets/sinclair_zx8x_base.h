@@ -94,27 +94,27 @@ static const uint8_t K_DOT     = B0010111;
 // --- specials ---------------------------------------------------------------
 
 // combo definitions common for ZX80 and ZX81
-static const uint8_t combo_left[]         = {K_SHIFT, K_5, NA};
-static const uint8_t combo_down[]         = {K_SHIFT, K_6, NA};
-static const uint8_t combo_up[]           = {K_SHIFT, K_7, NA};
-static const uint8_t combo_right[]        = {K_SHIFT, K_8, NA};
-static const uint8_t combo_rubout[]       = {K_SHIFT, K_0, NA};
-static const uint8_t combo_dollar[]       = {K_SHIFT, K_U, NA};
-static const uint8_t combo_open_paren[]   = {K_SHIFT, K_I, NA};
-static const uint8_t combo_close_paren[]  = {K_SHIFT, K_O, NA};
-static const uint8_t combo_exp[]          = {K_SHIFT, K_H, NA};
-static const uint8_t combo_minus[]        = {K_SHIFT, K_J, NA};
-static const uint8_t combo_plus[]         = {K_SHIFT, K_K, NA};
-static const uint8_t combo_equal[]        = {K_SHIFT, K_L, NA};
-static const uint8_t combo_caps_lock[]    = {TOGGLE, K_SHIFT, NA};
-static const uint8_t combo_colon[]        = {K_SHIFT, K_Z, NA};
-static const uint8_t combo_semicolon[]    = {K_SHIFT, K_X, NA};
-static const uint8_t combo_question[]     = {K_SHIFT, K_C, NA};
-static const uint8_t combo_slash[]        = {K_SHIFT, K_V, NA};
-static const uint8_t combo_lower[]        = {K_SHIFT, K_N, NA};
-static const uint8_t combo_greater[]      = {K_SHIFT, K_M, NA};
-static const uint8_t combo_comma[]        = {K_SHIFT, K_DOT, NA};
-static const uint8_t combo_pound[]        = {K_SHIFT, K_SPACE, NA};
+static constexpr uint8_t combo_left[]         PROGMEM = {K_SHIFT, K_5, NA};
+static constexpr uint8_t combo_down[]         PROGMEM = {K_SHIFT, K_6, NA};
+static constexpr uint8_t combo_up[]           PROGMEM = {K_SHIFT, K_7, NA};
+static constexpr uint8_t combo_right[]        PROGMEM = {K_SHIFT, K_8, NA};
+static constexpr uint8_t combo_rubout[]       PROGMEM = {K_SHIFT, K_0, NA};
+static constexpr uint8_t combo_dollar[]       PROGMEM = {K_SHIFT, K_U, NA};
+static constexpr uint8_t combo_open_paren[]   PROGMEM = {K_SHIFT, K_I, NA};
+static constexpr uint8_t combo_close_paren[]  PROGMEM = {K_SHIFT, K_O, NA};
+static constexpr uint8_t combo_exp[]          PROGMEM = {K_SHIFT, K_H, NA};
+static constexpr uint8_t combo_minus[]        PROGMEM = {K_SHIFT, K_J, NA};
+static constexpr uint8_t combo_plus[]         PROGMEM = {K_SHIFT, K_K, NA};
+static constexpr uint8_t combo_equal[]        PROGMEM = {K_SHIFT, K_L, NA};
+static constexpr uint8_t combo_caps_lock[]    PROGMEM = {TOGGLE, K_SHIFT, NA};
+static constexpr uint8_t combo_colon[]        PROGMEM = {K_SHIFT, K_Z, NA};
+static constexpr uint8_t combo_semicolon[]    PROGMEM = {K_SHIFT, K_X, NA};
+static constexpr uint8_t combo_question[]     PROGMEM = {K_SHIFT, K_C, NA};
+static constexpr uint8_t combo_slash[]        PROGMEM = {K_SHIFT, K_V, NA};
+static constexpr uint8_t combo_lower[]        PROGMEM = {K_SHIFT, K_N, NA};
+static constexpr uint8_t combo_greater[]      PROGMEM = {K_SHIFT, K_M, NA};
+static constexpr uint8_t combo_comma[]        PROGMEM = {K_SHIFT, K_DOT, NA};
+static constexpr uint8_t combo_pound[]        PROGMEM = {K_SHIFT, K_SPACE, NA};
 
 // macro definitions common for ZX80 and ZX81
 
@@ -0,0 +1,126 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include "textkbd.h"
+
+//
+TextKbd::TextKbd() {}
+
+//
+void TextKbd::reset() {
+    DPRINTLN("[TEXT] resetting");
+    head = 0;
+    tail = 0;
+    received = 0;
+    limit = 0;
+    resync = false;
+    active = false;
+    dropped = 0;
+}
+
+// number of characters in buffer
+uint8_t TextKbd::count() {
+    return (head + TEXT_BUFFER_SIZE - tail) % TEXT_BUFFER_SIZE;
+}
+
+// Adds the payload of a text frame to the buffer. An empty payload means the
+// host has run out of credits.
+void TextKbd::receive(const uint8_t text[], uint8_t length) {
+
+    active = true;
+
+    if (length == 0) {
+        DPRINTLN("[TEXT] host out of credits");
+        resync = true;
+        return;
+    }
+
+    received += length;
+
+    for (uint8_t ix = 0; ix < length; ix++) {
+        if (count() == TEXT_BUFFER_SIZE - 1) {
+            dropped++;
+            DPRINTLN("[TEXT] buffer full, dropped: " + String(dropped));
+            continue;
+        }
+        buf[head] = text[ix];
+        head = (head + 1) % TEXT_BUFFER_SIZE;
+    }
+}
+
+// Fills in the payload of a credits frame to send to the host now, and
+// returns its length, 0 if there's nothing to send. The payload is the new
+// credit limit, followed by the count of received bytes when replying to an
+// empty text frame. Credits are handed out in batches, to keep the number of
+// credits frames low, but all remaining space is granted once the buffer has
+// run empty.
+uint8_t TextKbd::grant(uint8_t credits[2]) {
+
+    if (!active) {
+        return 0;
+    }
+
+    uint8_t more = received + TEXT_BUFFER_SIZE - 1 - count() - limit;
+
+    if (!resync
+        && (more == 0 || (more < TEXT_CREDIT_BATCH && count() > 0))) {
+        return 0;
+    }
+
+    limit += more;
+    credits[0] = limit;
+    credits[1] = received;
+    DPRINTLN("[TEXT] granting " + String(more) + ", limit: " + String(limit));
+
+    if (resync) {
+        resync = false;
+        return 2;
+    }
+    return 1;
+}
+
+// types the next character, as soon as the target keyboard is idle
+void TextKbd::process(TargetKbd *kbd) {
+    if (count() > 0 && !kbd->isPlaying() && !kbd->isBusy()) {
+        char c = buf[tail];
+        tail = (tail + 1) % TEXT_BUFFER_SIZE;
+        type(c, kbd);
+    }
+}
+
+//
+void TextKbd::type(char c, TargetKbd *kbd) {
+
+    TextKey t = {NA, NA};
+
+    if (c == '\n') {
+        t = TEXT_NEWLINE;
+    } else if (c >= ' ' && c <= '~') {
+        memcpy_P(&t, MAP_TEXT_TO_TARGET + (c - ' '), sizeof(t));
+    }
+
+    DPRINTLN("[TEXT] char: " + String((uint8_t)c) + ", modifier: "
+        + String(t.modifier) + ", key: " + String(t.key));
+
+    if (t.key != NA) {
+        kbd->typeKey(t.key, t.modifier);
+    }
+}
+
+// number of bytes received without credit
+uint16_t TextKbd::drops() {
+    return dropped;
+}
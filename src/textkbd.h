@@ -0,0 +1,75 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef TEXTKBD_h
+#define TEXTKBD_h
+
+#include <Arduino.h>
+
+#include "config.h"
+#include "tables.h"
+#include "targetkbd.h"
+
+static_assert(TEXT_BUFFER_SIZE >= 8 && TEXT_BUFFER_SIZE <= 128,
+    "TEXT_BUFFER_SIZE needs to be between 8 and 128");
+
+// credits are granted in batches of at least this many bytes, unless the
+// buffer ran empty
+static const uint8_t TEXT_CREDIT_BATCH = TEXT_BUFFER_SIZE / 4;
+
+/*
+    Text engine: text received via the serial port is collected in a ring
+    buffer, and typed on the target one character at a time, as fast as the
+    target's timing profile permits. Characters are translated to target keys
+    with the target's text map.
+
+    Flow control is credit based: the host may only send as many bytes as it
+    has been granted credits for. Credits are cumulative: we count all bytes
+    received, modulo 256, and grant up to that count plus the free buffer
+    space, so the buffer never overflows. This credit limit is what we send
+    in a credits frame, and the host's credits are the difference to the
+    number of bytes it has sent so far. A lost credits frame is therefore
+    made up for by the next one. A host that runs out of credits sends an
+    empty text frame, to which we reply with the limit and our count of
+    received bytes, so the host can also get back in step after lost bytes.
+    We only grant credits after the host has sent its first text frame, which
+    may be empty.
+ */
+class TextKbd {
+
+private:
+    char buf[TEXT_BUFFER_SIZE];
+    uint8_t head;
+    uint8_t tail;
+    uint8_t received;     // bytes received, modulo 256
+    uint8_t limit;        // credit limit last granted
+    bool resync;          // host asked for limit and count, see `grant`
+    bool active;          // host has sent text, so it expects credits
+    uint16_t dropped;     // bytes received without credit
+
+    uint8_t count();
+    void type(char c, TargetKbd *kbd);
+
+public:
+    TextKbd();
+    void reset();
+    void receive(const uint8_t text[], uint8_t length);
+    uint8_t grant(uint8_t credits[2]);
+    void process(TargetKbd *kbd);
+    uint16_t drops();
+};
+
+#endif
@@ -0,0 +1,161 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+
+#include "watchdog.h"
+
+//
+Watchdog::Watchdog() {}
+
+//
+void Watchdog::reset() {
+    DPRINTLN("[ DOG] resetting");
+    count = 0;
+    armed = false;
+    released = 0;
+}
+
+// called for each heartbeat frame from the host
+void Watchdog::heartbeat() {
+    armed = true;
+    heard = millis();
+}
+
+// Tracks key event `e` on its way to the target keyboard. Returns false when
+// the event is the release of a key the watchdog has already released, and
+// so must not be passed on.
+bool Watchdog::track(const KeyEvent &e) {
+
+    if (e.key == NA) {
+        return true;
+    }
+
+    switch (e.action) {
+
+        case PRESS_KEY:
+            if (maxHold(e.source) > 0 || isHost(e.source)) {
+                add(e);
+            }
+            return true;
+
+        case RELEASE_KEY:
+            for (uint8_t ix = count; ix-- > 0; ) {
+                if (held[ix].source == e.source && held[ix].key == e.key) {
+                    bool expired = held[ix].expired;
+                    remove(ix);
+                    return !expired;
+                }
+            }
+            return true;
+
+        default: // toggles are never stuck
+            return true;
+    }
+}
+
+// Adds a key press. When all slots are taken, a key already released by the
+// watchdog makes room, otherwise the press goes untracked.
+void Watchdog::add(const KeyEvent &e) {
+
+    if (count == WATCHDOG_SLOTS) {
+        for (uint8_t ix = 0; ix < count; ix++) {
+            if (held[ix].expired) {
+                remove(ix);
+                break;
+            }
+        }
+    }
+
+    if (count == WATCHDOG_SLOTS) {
+        DPRINTLN("[ DOG] no slot for key " + String(e.key));
+        return;
+    }
+
+    HeldKey &h = held[count++];
+    h.source = e.source;
+    h.expired = 0;
+    h.key = e.key;
+    h.since = e.time;
+}
+
+//
+void Watchdog::remove(uint8_t ix) {
+    held[ix] = held[--count];
+}
+
+// Releases all keys held for too long, and all host keys when the host has
+// been lost. Returns true in the latter case.
+bool Watchdog::process(TargetKbd *kbd) {
+
+    bool lost = armed && millis() - heard > HOST_HEARTBEAT_TIMEOUT;
+    if (lost) {
+        DPRINTLN("[ DOG] host lost");
+        armed = false;
+    }
+
+    uint16_t now = millis();
+    bool changed = false;
+
+    for (uint8_t ix = 0; ix < count; ix++) {
+
+        HeldKey &h = held[ix];
+        uint16_t max = maxHold(h.source);
+
+        if (h.expired || !((lost && isHost(h.source))
+            || (max > 0 && (uint16_t)(now - h.since) > max))) {
+            continue;
+        }
+
+        released++;
+        DPRINTLN("[ DOG] releasing key " + String(h.key) + " of source "
+            + String(h.source) + ", released: " + String(released));
+        kbd->updateKey(h.key, RELEASE_KEY);
+        h.expired = 1;
+        changed = true;
+    }
+
+    if (changed) {
+        kbd->commit();
+    }
+
+    return lost;
+}
+
+//
+uint16_t Watchdog::releases() {
+    return released;
+}
+
+// maximum hold time in ms for keys from `source`, 0 for no limit
+uint16_t Watchdog::maxHold(uint8_t source) {
+    switch (source) {
+        case SOURCE_SERIAL:
+            return WATCHDOG_MAX_HOLD_SERIAL;
+        case SOURCE_PS2:
+            return WATCHDOG_MAX_HOLD_PS2;
+        case SOURCE_JOYSTICK:
+            return WATCHDOG_MAX_HOLD_JOYSTICK;
+        case SOURCE_MOVIE:
+            return WATCHDOG_MAX_HOLD_MOVIE;
+        default:
+            return 0;
+    }
+}
+
+// whether keys from `source` are sent by the host
+bool Watchdog::isHost(uint8_t source) {
+    return source == SOURCE_SERIAL || source == SOURCE_MOVIE;
+}
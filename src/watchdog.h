@@ -0,0 +1,74 @@
+/*
+    Copyright 2020 Alexander Vollschwitz <xelalex@gmx.net>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+
+#ifndef WATCHDOG_h
+#define WATCHDOG_h
+
+#include <Arduino.h>
+
+#include "config.h"
+#include "eventqueue.h"
+#include "targetkbd.h"
+
+// number of key presses that can be tracked at the same time
+static const uint8_t WATCHDOG_SLOTS = 16;
+
+//
+struct HeldKey {
+    uint8_t source  : 3; // `EventSource`
+    uint8_t expired : 1; // released by watchdog, waiting for real release
+    uint8_t key;
+    uint16_t since;      // lower 16 bits of `millis` when pressed
+};
+
+/*
+    Stuck key watchdog: all key presses passing from the event queue to the
+    target keyboard are tracked, and released automatically once they have
+    been held longer than the maximum hold time for their source (see
+    config.h). This takes care of lost break codes, e.g. when the host dies
+    in the middle of a key stroke. When the real release arrives later on, it
+    is swallowed, so it doesn't release a hold of another source.
+
+    Keys from the host, i.e. serial keys and movies, are additionally covered
+    by heartbeats: once the host has sent a heartbeat frame, it needs to keep
+    sending them at least every `HOST_HEARTBEAT_TIMEOUT` ms. Otherwise, we
+    consider the host lost and release all of its keys.
+ */
+class Watchdog {
+
+private:
+    HeldKey held[WATCHDOG_SLOTS];
+    uint8_t count;
+    bool armed;             // host has sent heartbeats
+    unsigned long heard;    // `millis` time stamp of last heartbeat
+    uint16_t released;      // keys released by watchdog
+
+    uint16_t maxHold(uint8_t source);
+    bool isHost(uint8_t source);
+    void add(const KeyEvent &e);
+    void remove(uint8_t ix);
+
+public:
+    Watchdog();
+    void reset();
+    void heartbeat();
+    bool track(const KeyEvent &e);
+    bool process(TargetKbd *kbd);
+    uint16_t releases();
+};
+
+#endif
@@ -22,6 +22,10 @@
 #include <string.h>
 #include <stdio.h>
 #include <termios.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/time.h>
+#include <stdint.h>
 
 // for window focus
 #include <locale.h>
@@ -62,6 +66,58 @@ static const char *const keyActionTypes[3] = {
 static const int BREAK = 0;
 static const int MAKE = 1;
 
+/*
+    serial protocol; v1 sends each key event as a two byte frame {make/break,
+    code}, v2 frames look like this:
+
+        | SYNC | TYPE | SEQ | LEN | PAYLOAD ... | CRC |
+
+    with CRC being a CRC-8 (polynomial 0x07) over TYPE, SEQ, LEN, and payload.
+    See src/serialparser.h for details.
+ */
+#define PROTOCOL_VERSION        2
+#define PROTOCOL_SYNC           0xa5
+#define PROTOCOL_HEADER_LEN     4
+#define PROTOCOL_MAX_PAYLOAD    255
+
+#define FRAME_EVENTS            'E'
+#define FRAME_CAPABILITIES      'C'
+#define FRAME_TEXT              'X'
+#define FRAME_CREDITS           'K'
+#define FRAME_MOVIE             'P'
+#define FRAME_MOVIE_CREDITS     'R'
+#define FRAME_CLOCK             'S'
+#define FRAME_TIMED_EVENTS      'D'
+#define FRAME_HEARTBEAT         'H'
+#define FRAME_STATS             '#'
+#define FRAME_PROFILE           'J'
+
+#define EVENT_MAKE              0x80
+#define EVENT_CODE              0x7f
+
+#define MOVIE_JOYSTICK          2
+#define MOVIE_END               0x80
+
+#define TIMED_EVENT_LEN         5
+#define CLOCK_SYNC_ROUNDS       8
+#define CLOCK_SYNC_INTERVAL_US  1000000
+
+#define PROBE_ATTEMPTS          12
+#define PROBE_TIMEOUT_MS        500
+#define CREDITS_TIMEOUT_MS      3000
+#define CREDITS_DEADLINE_MS     15000
+#define HEARTBEAT_INTERVAL_MS   500
+#define TEXT_DONE_WAIT_US       500000
+
+int protocolVersion = 1;
+int maxPayload = 0;
+int textCapacity = 0;
+int movieWindow = 0;
+int movieRecordLen = 0;
+int scheduleSize = 0;
+long scheduleLeadUs = 0;
+unsigned char txSeq = 0;
+
 void cleanup();
 
 // file descriptors
@@ -155,15 +211,361 @@ void close_serial_port(int fd) {
 }
 
 //
-void send_key_stroke(int typ, int code, int fdSer) {
+unsigned char crc8(unsigned char crc, const unsigned char* data, int len) {
+    for (int i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++) {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+    }
+    return crc;
+}
 
-    if (typ < 0 || typ >= LEN(keyActionTypes)) {
+// sends a two byte command frame; these are understood by v1 & v2 adapters
+void send_command(char cmd, char arg, int fdSer) {
+    char sendBuf[2] = {cmd, arg};
+    log_debug("sending command to serial: [%c, 0x%x]", cmd, arg);
+    write(fdSer, &sendBuf, 2);
+}
+
+//
+void send_frame(unsigned char type, const unsigned char* payload, int len,
+    int fdSer) {
+
+    unsigned char buf[PROTOCOL_HEADER_LEN + PROTOCOL_MAX_PAYLOAD + 1];
+
+    buf[0] = PROTOCOL_SYNC;
+    buf[1] = type;
+    buf[2] = txSeq++;
+    buf[3] = (unsigned char)len;
+    memcpy(buf + PROTOCOL_HEADER_LEN, payload, len);
+    buf[PROTOCOL_HEADER_LEN + len] =
+        crc8(0, buf + 1, PROTOCOL_HEADER_LEN - 1 + len);
+
+    log_debug("sending frame '%c' to serial, seq %d, %d byte(s) payload",
+        type, buf[2], len);
+    write(fdSer, buf, PROTOCOL_HEADER_LEN + len + 1);
+}
+
+// waits for a v2 frame of given type; returns 1 when received, 0 when nothing
+// at all was received, and -1 when only other data was received
+int read_frame(int fdSer, unsigned char type, unsigned char* payload,
+    int* len, int timeoutMs) {
+
+    unsigned char buf[PROTOCOL_HEADER_LEN + PROTOCOL_MAX_PAYLOAD + 1];
+    int n = 0;
+    int heard = 0;
+    struct pollfd pfd = {fdSer, POLLIN, 0};
+
+    while (poll(&pfd, 1, timeoutMs) > 0) {
+
+        if (read(fdSer, buf + n, 1) != 1) {
+            continue;
+        }
+
+        heard = 1;
+
+        if (n == 0 && buf[0] != PROTOCOL_SYNC) {
+            continue; // e.g. hello message
+        }
+
+        n++;
+
+        if (n < PROTOCOL_HEADER_LEN || n < PROTOCOL_HEADER_LEN + buf[3] + 1) {
+            continue;
+        }
+
+        int l = buf[3];
+        if (buf[1] == type &&
+            crc8(0, buf + 1, PROTOCOL_HEADER_LEN - 1 + l)
+                == buf[PROTOCOL_HEADER_LEN + l]) {
+            memcpy(payload, buf + PROTOCOL_HEADER_LEN, l);
+            *len = l;
+            return 1;
+        }
+
+        n = 0;
+    }
+
+    return heard ? -1 : 0;
+}
+
+// Finds out which protocol version to use. The adapter may just be resetting
+// after the serial port was opened, so we keep probing for a while. Once we
+// heard anything at all from it, e.g. its hello message, a v2 adapter would
+// reply to the next probe, so if it doesn't, we fall back to v1.
+void negotiate_protocol(int fdSer) {
+
+    log_info("negotiating protocol version");
+
+    unsigned char caps[PROTOCOL_MAX_PAYLOAD];
+    int len;
+    int heard = 0;
+
+    for (int attempt = 0; attempt < PROBE_ATTEMPTS; attempt++) {
+
+        send_command('V', PROTOCOL_VERSION, fdSer);
+
+        switch (read_frame(
+            fdSer, FRAME_CAPABILITIES, caps, &len, PROBE_TIMEOUT_MS)) {
+
+            case 1:
+                if (len >= 2 && caps[0] >= 2 && caps[1] > 0) {
+                    protocolVersion = 2;
+                    maxPayload = caps[1];
+                    textCapacity = len >= 3 ? caps[2] : 0;
+                    movieWindow = len >= 5 ? caps[3] : 0;
+                    movieRecordLen = len >= 5 ? caps[4] : 0;
+                    scheduleSize = len >= 6 ? caps[5] : 0;
+                    log_info("using protocol v2, max payload %d", maxPayload);
+                    return;
+                }
+                attempt = PROBE_ATTEMPTS;
+                break;
+
+            case -1:
+                if (heard) {
+                    attempt = PROBE_ATTEMPTS;
+                }
+                heard = 1;
+                break;
+        }
+    }
+
+    log_info("adapter does not support protocol v2, falling back to v1");
+}
+
+// --- clock sync -------------------------------------------------------------
+
+/*
+    For timed events, we need to know the adapter's `micros` time for any of
+    our own times. The adapter replies to a clock frame with its current time.
+    Of several such exchanges, we take the one with the shortest round trip,
+    and assume the adapter's time was taken half way through it. Since the
+    adapter's clock drifts against ours, we repeat this from time to time, and
+    estimate the drift rate from the first and the latest sync. Adapter times
+    are 32 bit and wrap around, so we keep track of the total elapsed time.
+ */
+int64_t clockHostStart = -1;    // our time at first sync
+int64_t clockHostLast;          // our time at latest sync
+int64_t clockTargetElapsed;     // adapter time passed since first sync
+uint32_t clockTargetLast;       // adapter time at latest sync
+double clockRate = 1.0;         // adapter µs per host µs
+
+//
+int64_t now_us() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+//
+void sync_clock(int fdSer) {
+
+    unsigned char payload[PROTOCOL_MAX_PAYLOAD];
+    int len;
+    int64_t best = -1;
+    int64_t host = 0;
+    uint32_t target = 0;
+
+    for (int round = 0; round < CLOCK_SYNC_ROUNDS; round++) {
+        int64_t start = now_us();
+        send_frame(FRAME_CLOCK, payload, 0, fdSer);
+        if (read_frame(fdSer, FRAME_CLOCK, payload, &len, PROBE_TIMEOUT_MS)
+            != 1 || len < 4) {
+            continue;
+        }
+        int64_t rtt = now_us() - start;
+        if (best < 0 || rtt < best) {
+            best = rtt;
+            host = start + rtt / 2;
+            target = payload[0] | (payload[1] << 8) | (payload[2] << 16)
+                | ((uint32_t)payload[3] << 24);
+        }
+    }
+
+    if (best < 0) {
+        log_error("clock sync failed");
         return;
     }
 
+    if (clockHostStart < 0) {
+        clockHostStart = host;
+        clockTargetElapsed = 0;
+    } else {
+        clockTargetElapsed += (uint32_t)(target - clockTargetLast);
+        if (host - clockHostStart > CLOCK_SYNC_INTERVAL_US) {
+            clockRate = (double)clockTargetElapsed / (host - clockHostStart);
+        }
+    }
+
+    clockHostLast = host;
+    clockTargetLast = target;
+
+    log_debug("clock synced, round trip %lld µs, rate %.6f",
+        (long long)best, clockRate);
+}
+
+// adapter time for given time of ours
+uint32_t target_time(int64_t host) {
+    return clockTargetLast + (uint32_t)(int64_t)(
+        (host - clockHostLast) * clockRate);
+}
+
+// Appends key event `ev` to payload as timed event, due `scheduleLeadUs` after
+// our time `host`; syncs the clock first if it's been a while.
+int pack_timed_event(unsigned char ev, int64_t host, unsigned char* payload,
+    int fdSer) {
+
+    if (now_us() - clockHostLast > CLOCK_SYNC_INTERVAL_US) {
+        sync_clock(fdSer);
+    }
+
+    uint32_t due = target_time(host + scheduleLeadUs);
+    payload[0] = due & 0xff;
+    payload[1] = (due >> 8) & 0xff;
+    payload[2] = (due >> 16) & 0xff;
+    payload[3] = (due >> 24) & 0xff;
+    payload[4] = ev;
+    return TIMED_EVENT_LEN;
+}
+
+// --- keep alive & stats ------------------------------------------------------
+
+// Tells the adapter we're still there. Once we've sent a heartbeat, the
+// adapter releases all keys we hold when heartbeats stop, e.g. when we die.
+void send_heartbeat(int fdSer) {
+    if (protocolVersion >= 2) {
+        send_frame(FRAME_HEARTBEAT, NULL, 0, fdSer);
+    }
+}
+
+//
+gboolean heartbeat_timeout(gpointer data) {
+    send_heartbeat(fdSerialPort);
+    return TRUE;
+}
+
+// asks the adapter for its problem counters and logs them
+void log_stats(int fdSer) {
+
+    static const char *const names[] = {
+        "event queue overflows",
+        "CRC errors",
+        "lost frames",
+        "text bytes dropped",
+        "late movie records",
+        "dropped movie records",
+        "late timed events",
+        "dropped timed events",
+        "stuck keys released"
+    };
+
+    unsigned char payload[PROTOCOL_MAX_PAYLOAD];
+    int len;
+
+    if (protocolVersion < 2) {
+        return;
+    }
+
+    send_frame(FRAME_STATS, payload, 0, fdSer);
+    if (read_frame(fdSer, FRAME_STATS, payload, &len, PROBE_TIMEOUT_MS) != 1) {
+        log_error("no stats from adapter");
+        return;
+    }
+
+    for (int ix = 0; ix < LEN(names) && 2 * ix + 1 < len; ix++) {
+        int v = payload[2 * ix] | (payload[2 * ix + 1] << 8);
+        if (v > 0) {
+            log_info("%s: %d", names[ix], v);
+        }
+    }
+}
+
+// Selects the joystick profile given as `{index}[:{name}]` on the adapter, and
+// names it if a name is given. Returns 0 if that's not possible.
+int select_profile(const char* spec, int fdSer) {
+
+    unsigned char payload[PROTOCOL_MAX_PAYLOAD];
+    int len = 0;
+    char* end;
+    long ix = strtol(spec, &end, 10);
+
+    if (end == spec || ix < 0 || ix > 255 || (*end != '\0' && *end != ':')) {
+        log_fatal("invalid joystick profile: '%s'", spec);
+        return 0;
+    }
+
+    if (protocolVersion < 2) {
+        log_fatal("adapter does not support joystick profiles");
+        return 0;
+    }
+
+    payload[len++] = ix;
+    if (*end == ':') {
+        for (const char* c = end + 1; *c != '\0' && len < maxPayload; c++) {
+            payload[len++] = *c;
+        }
+    }
+
+    send_frame(FRAME_PROFILE, payload, len, fdSer);
+    if (read_frame(fdSer, FRAME_PROFILE, payload, &len, PROBE_TIMEOUT_MS) != 1
+        || len < 2) {
+        log_fatal("adapter does not support joystick profiles");
+        return 0;
+    }
+
+    if (payload[0] != ix) {
+        log_fatal("no joystick profile %ld, adapter has %d", ix, payload[1]);
+        return 0;
+    }
+
+    log_info("joystick profile %d of %d: '%.*s'",
+        payload[0], payload[1], len - 2, payload + 2);
+    return 1;
+}
+
+// packs key event into v2 event byte; returns 0 if not possible
+int pack_key_stroke(int typ, int code, unsigned char* ev) {
+    if (code & ~EVENT_CODE) {
+        log_debug("cannot send code %d with protocol v2, dropping", code);
+        return 0;
+    }
+    *ev = (typ == MAKE ? EVENT_MAKE : 0) | code;
+    return 1;
+}
+
+//
+int is_key_stroke(int typ, int code) {
+
+    if (typ < 0 || typ >= LEN(keyActionTypes)) {
+        return 0;
+    }
+
     log_debug("%s 0x%04x (%d)", keyActionTypes[typ], code, code);
 
-    if (typ != MAKE && typ != BREAK) {
+    return typ == MAKE || typ == BREAK;
+}
+
+//
+void send_key_stroke(int typ, int code, int fdSer) {
+
+    if (!is_key_stroke(typ, code)) {
+        return;
+    }
+
+    if (protocolVersion >= 2) {
+        unsigned char ev;
+        if (!pack_key_stroke(typ, code, &ev)) {
+            return;
+        }
+        if (scheduleLeadUs > 0) {
+            unsigned char payload[TIMED_EVENT_LEN];
+            send_frame(FRAME_TIMED_EVENTS, payload,
+                pack_timed_event(ev, now_us(), payload, fdSer), fdSer);
+        } else {
+            send_frame(FRAME_EVENTS, &ev, 1, fdSer);
+        }
         return;
     }
 
@@ -175,6 +577,53 @@ void send_key_stroke(int typ, int code, int fdSer) {
     write(fdSer, &sendBuf, 2);
 }
 
+// Sends all key events in given list; with protocol v2, they are packed into
+// as few frames as possible. When scheduling, each event is sent as timed
+// event, keeping the time stamps the kernel gave them.
+void send_key_strokes(struct input_event* evs, int count, int fdSer) {
+
+    unsigned char payload[PROTOCOL_MAX_PAYLOAD];
+    unsigned char type = scheduleLeadUs > 0 ? FRAME_TIMED_EVENTS : FRAME_EVENTS;
+    int max = scheduleLeadUs > 0 ?
+        maxPayload - maxPayload % TIMED_EVENT_LEN : maxPayload;
+    unsigned char ev;
+    int len = 0;
+
+    for (int i = 0; i < count; i++) {
+
+        if (evs[i].type != EV_KEY) {
+            continue;
+        }
+
+        if (protocolVersion < 2) {
+            send_key_stroke(evs[i].value, evs[i].code, fdSer);
+            continue;
+        }
+
+        if (!is_key_stroke(evs[i].value, evs[i].code) ||
+            !pack_key_stroke(evs[i].value, evs[i].code, &ev)) {
+            continue;
+        }
+
+        if (scheduleLeadUs > 0) {
+            int64_t host = (int64_t)evs[i].time.tv_sec * 1000000
+                + evs[i].time.tv_usec;
+            len += pack_timed_event(ev, host, payload + len, fdSer);
+        } else {
+            payload[len++] = ev;
+        }
+
+        if (len == max) {
+            send_frame(type, payload, len, fdSer);
+            len = 0;
+        }
+    }
+
+    if (len > 0) {
+        send_frame(type, payload, len, fdSer);
+    }
+}
+
 // --- keyboard image window --------------------------------------------------
 
 //
@@ -230,6 +679,7 @@ void open_keyboard_window_threaded(thread_data* d) {
         gtk_widget_add_events(window, GDK_KEY_PRESS_MASK | GDK_KEY_RELEASE_MASK);
         g_signal_connect(window, "key_press_event", G_CALLBACK(key_pressed), NULL);
         g_signal_connect(window, "key_release_event", G_CALLBACK(key_released), NULL);
+        g_timeout_add(HEARTBEAT_INTERVAL_MS, heartbeat_timeout, NULL);
     }
 
     g_signal_connect(window, "destroy", G_CALLBACK(window_destroy), NULL);
@@ -451,12 +901,24 @@ void read_kbd_and_send(Display* d, int fdKbd, int fdSer) {
 
     log_info("starting to read from keyboard");
 
-    struct input_event ev;
+    struct input_event evs[64];
+    struct pollfd pfd = {fdKbd, POLLIN, 0};
+    int64_t lastHeartbeat = 0;
     ssize_t n;
 
     while (TRUE) {
 
-        n = read(fdKbd, &ev, sizeof ev);
+        if (now_us() - lastHeartbeat >= HEARTBEAT_INTERVAL_MS * 1000) {
+            send_heartbeat(fdSer);
+            lastHeartbeat = now_us();
+        }
+
+        if (poll(&pfd, 1, HEARTBEAT_INTERVAL_MS) == 0) {
+            continue;
+        }
+
+        // read all events that are available, to send them in one go
+        n = read(fdKbd, evs, sizeof evs);
 
         if (d != NULL &&
             !is_in_focus(d, ownWindowName, bufName, sizeof(ownWindowName))) {
@@ -470,17 +932,172 @@ void read_kbd_and_send(Display* d, int fdKbd, int fdSer) {
             } else {
                 break;
             }
-        } else if (n != sizeof ev) {
+        } else if (n % sizeof *evs != 0) {
             errno = EIO;
             break;
         }
 
-        if (ev.type == EV_KEY) {
-            send_key_stroke(ev.value, ev.code, fdSer);
+        send_key_strokes(evs, n / sizeof *evs, fdSer);
+    }
+}
+
+
+// Credit state of a text or movie stream. The adapter reports a credit limit,
+// i.e. how many bytes or records we may have sent in total, modulo 256, so a
+// lost credits frame is made up for by the next one. Its replies to our empty
+// frames also carry how many it has received, which is where we pick up our
+// count of sent bytes or records.
+typedef struct {
+    unsigned char type;         // frame type of the stream
+    unsigned char creditsType;  // frame type of the adapter's credits
+    int capacity;               // most credits the adapter grants at once
+    int synced;                 // `sent` has been picked up from the adapter
+    unsigned char limit;        // credit limit last reported by the adapter
+    unsigned char sent;         // bytes or records sent, modulo 256
+} credits_state;
+
+// Number of credits we have left. When the adapter's count is behind ours,
+// e.g. because bytes got lost, the difference wraps around to more than its
+// capacity, and we have none until we're back in step.
+int credits_left(credits_state* c) {
+    int n = (unsigned char)(c->limit - c->sent);
+    return c->synced && n <= c->capacity ? n : 0;
+}
+
+// Waits for a credits frame from the adapter and updates the credit state,
+// sending heartbeats meanwhile. When no credits arrive in time, we may have
+// missed a credits frame, or the adapter some of our data, so we tell the
+// adapter with an empty frame, and wait again. The adapter answers that even
+// when it has no credits to grant, e.g. while a long movie is playing, so
+// when we hear nothing at all from it for `CREDITS_DEADLINE_MS`, it's gone,
+// and we give up and exit.
+void wait_for_credits(credits_state* c, int fdSer) {
+
+    unsigned char payload[PROTOCOL_MAX_PAYLOAD];
+    int len;
+    int waited = 0;
+    int64_t deadline = now_us() + CREDITS_DEADLINE_MS * 1000LL;
+
+    while (1) {
+        if (now_us() >= deadline) {
+            log_fatal("nothing heard from adapter for %d ms, giving up",
+                CREDITS_DEADLINE_MS);
+            close_serial_port(fdSer);
+            exit(EXIT_FAILURE);
+        }
+        send_heartbeat(fdSer);
+        int r = read_frame(fdSer, c->creditsType, payload, &len,
+            HEARTBEAT_INTERVAL_MS);
+        if (r != 0) {
+            deadline = now_us() + CREDITS_DEADLINE_MS * 1000LL;
+        }
+        if (r == 1 && len >= 1) {
+            if (len >= 2) { // reply to empty frame
+                c->sent = payload[1];
+                c->synced = 1;
+            }
+            c->limit = payload[0];
+            log_debug("credit limit %d, %d credit(s) left",
+                c->limit, credits_left(c));
+            if (c->synced) {
+                return;
+            }
+            continue;
+        }
+        waited += HEARTBEAT_INTERVAL_MS;
+        if (waited >= CREDITS_TIMEOUT_MS) {
+            send_frame(c->type, payload, 0, fdSer);
+            waited = 0;
         }
     }
 }
 
+// Streams text to the adapter's text engine, which types it on the target at
+// the target's own pace. We may only send as many bytes as we have credits
+// for. At the end, we wait until the adapter has granted credits for its
+// whole text buffer again, i.e. until all text has been typed.
+void send_text(FILE* in, int fdSer) {
+
+    unsigned char buf[PROTOCOL_MAX_PAYLOAD];
+    credits_state c = {FRAME_TEXT, FRAME_CREDITS, textCapacity, 0, 0, 0};
+    int sent = 0;
+    int credits;
+    int n;
+
+    log_info("sending text");
+    send_frame(FRAME_TEXT, buf, 0, fdSer); // ask for initial credits
+
+    do {
+        while ((credits = credits_left(&c)) == 0) {
+            wait_for_credits(&c, fdSer);
+        }
+        n = fread(buf, 1, credits < maxPayload ? credits : maxPayload, in);
+        if (n > 0) {
+            send_frame(FRAME_TEXT, buf, n, fdSer);
+            c.sent += n;
+            sent += n;
+        }
+    } while (n > 0);
+
+    while (credits_left(&c) < textCapacity) {
+        wait_for_credits(&c, fdSer);
+    }
+
+    usleep(TEXT_DONE_WAIT_US); // let the last character finish
+    log_info("sent %d byte(s) of text", sent);
+}
+
+// Streams an input movie to the adapter, which plays it frame by frame. The
+// file holds records as laid out in src/movie.h. Credits are counted in
+// records. If the movie doesn't end with an end record, we append one for the
+// frame after the last record. When the adapter grants its whole movie buffer
+// again, the movie is over.
+void send_movie(FILE* in, int fdSer) {
+
+    unsigned char buf[PROTOCOL_MAX_PAYLOAD];
+    credits_state c = {FRAME_MOVIE, FRAME_MOVIE_CREDITS, movieWindow, 0, 0, 0};
+    int perFrame = maxPayload / movieRecordLen;
+    int sent = 0;
+    int ended = 0;
+    int frame = -1;
+    int credits;
+    int n;
+
+    log_info("sending movie");
+    send_frame(FRAME_MOVIE, buf, 0, fdSer); // ask for initial credits
+
+    while (!ended) {
+        while ((credits = credits_left(&c)) == 0) {
+            wait_for_credits(&c, fdSer);
+        }
+        n = fread(buf, movieRecordLen,
+            credits < perFrame ? credits : perFrame, in);
+        if (n == 0) { // missing end record
+            memset(buf, 0, movieRecordLen);
+            buf[0] = (frame + 1) & 0xff;
+            buf[1] = ((frame + 1) >> 8) & 0xff;
+            buf[MOVIE_JOYSTICK] = MOVIE_END;
+            n = 1;
+        }
+        for (int ix = 0; ix < n && !ended; ix++) {
+            unsigned char* rec = buf + ix * movieRecordLen;
+            frame = rec[0] | (rec[1] << 8);
+            if (rec[MOVIE_JOYSTICK] & MOVIE_END) {
+                ended = 1;
+                n = ix + 1;
+            }
+        }
+        send_frame(FRAME_MOVIE, buf, n * movieRecordLen, fdSer);
+        c.sent += n;
+        sent += n;
+    }
+
+    while (credits_left(&c) < movieWindow) {
+        wait_for_credits(&c, fdSer);
+    }
+
+    log_info("played movie of %d record(s), %d frame(s)", sent, frame + 1);
+}
 
 // --- main -------------------------------------------------------------------
 
@@ -488,6 +1105,7 @@ void read_kbd_and_send(Display* d, int fdKbd, int fdSer) {
 void usage() {
     printf("\nsynopsis:\n\n  kev \
 -p {serial port device} [-i {keyboard image file}] [-k {keyboard device}] [-a] \
+[-t {text file}] [-m {movie file}] [-d {delay}] [-j {profile}[:{name}]] \
 [-v debug|trace]\n\n\
     -i  open new window with given image file and listen for key events there;\n\
         does not require root privileges, and all key event sources of the\n\
@@ -497,6 +1115,18 @@ void usage() {
         using -i; requires root privileges\n\n\
     -a  read all key events, regardless of whether console window is in focus;\n\
         implies -k\n\n\
+    -t  type the given text file on the target, '-' for stdin, then exit;\n\
+        requires an adapter supporting protocol v2\n\n\
+    -m  play the given input movie file on the target, '-' for stdin, then\n\
+        exit; requires an adapter supporting protocol v2\n\n\
+    -d  play key events on the target with their original timing, delayed by\n\
+        the given number of milliseconds, e.g. 20; this removes jitter\n\
+        caused by the serial connection, but the adapter may still shift an\n\
+        event by one pass of its main loop plus the target's minimum key\n\
+        hold or gap time; requires an adapter supporting timed events\n\n\
+    -j  select the given joystick profile, counting from 0, and name it if a\n\
+        name is given, e.g. 1:jetpac; requires an adapter supporting protocol\n\
+        v2\n\n\
     -v  log level, 'debug' or 'trace'\n\n");
     exit(EXIT_SUCCESS);
 }
@@ -504,7 +1134,8 @@ void usage() {
 //
 void cleanup() {
     close_keyboard(fdKeyboard);
-    send_key_stroke('!', 0, fdSerialPort); // reset adapter
+    log_stats(fdSerialPort);
+    send_command('!', 0, fdSerialPort); // reset adapter
     close_serial_port(fdSerialPort);
 }
 
@@ -527,10 +1158,13 @@ int main(int argc, char* argv[]) {
     char* devKbd = NULL;
     char* imgKbd = NULL;
     char* portName = NULL;
+    char* textFile = NULL;
+    char* movieFile = NULL;
+    char* profile = NULL;
     int useDisplay = 1;
 
     int opt;
-    while((opt = getopt(argc, argv, ":hk:i:p:lv:")) != -1) {
+    while((opt = getopt(argc, argv, ":hk:i:p:lt:m:d:j:v:")) != -1) {
         switch(opt) {
 
             case 'h':
@@ -553,6 +1187,22 @@ int main(int argc, char* argv[]) {
                 useDisplay = 0;
                 break;
 
+            case 't': // text file (optional)
+                textFile = optarg;
+                break;
+
+            case 'm': // movie file (optional)
+                movieFile = optarg;
+                break;
+
+            case 'd': // scheduling delay (optional)
+                scheduleLeadUs = atol(optarg) * 1000;
+                break;
+
+            case 'j': // joystick profile (optional)
+                profile = optarg;
+                break;
+
             case 'v': // log level
                 if (strcmp("debug", optarg) == 0) {
                     log_set_level(LOG_DEBUG);
@@ -588,6 +1238,60 @@ int main(int argc, char* argv[]) {
     signal(SIGINT, sigIntHandler);
 
     fdSerialPort = open_serial_port_or_die(portName);
+    negotiate_protocol(fdSerialPort);
+
+    if (profile != NULL && !select_profile(profile, fdSerialPort)) {
+        close_serial_port(fdSerialPort);
+        return EXIT_FAILURE;
+    }
+
+    if (textFile != NULL) {
+        if (protocolVersion < 2 || textCapacity == 0) {
+            log_fatal("adapter does not support text mode");
+            close_serial_port(fdSerialPort);
+            return EXIT_FAILURE;
+        }
+        FILE* in = strcmp(textFile, "-") == 0 ? stdin : fopen(textFile, "r");
+        if (in == NULL) {
+            log_fatal("cannot open %s: %s", textFile, strerror(errno));
+            close_serial_port(fdSerialPort);
+            return EXIT_FAILURE;
+        }
+        send_text(in, fdSerialPort);
+        log_stats(fdSerialPort);
+        fclose(in);
+        close_serial_port(fdSerialPort);
+        return EXIT_SUCCESS;
+    }
+
+    if (scheduleLeadUs > 0) {
+        if (protocolVersion < 2 || scheduleSize == 0) {
+            log_error("adapter does not support timed events, ignoring -d");
+            scheduleLeadUs = 0;
+        } else {
+            sync_clock(fdSerialPort);
+        }
+    }
+
+    if (movieFile != NULL) {
+        if (protocolVersion < 2 || movieWindow == 0) {
+            log_fatal("adapter does not support movies");
+            close_serial_port(fdSerialPort);
+            return EXIT_FAILURE;
+        }
+        FILE* in = strcmp(movieFile, "-") == 0 ?
+            stdin : fopen(movieFile, "rb");
+        if (in == NULL) {
+            log_fatal("cannot open %s: %s", movieFile, strerror(errno));
+            close_serial_port(fdSerialPort);
+            return EXIT_FAILURE;
+        }
+        send_movie(in, fdSerialPort);
+        log_stats(fdSerialPort);
+        fclose(in);
+        close_serial_port(fdSerialPort);
+        return EXIT_SUCCESS;
+    }
 
     Display* disp = NULL;
     if (useDisplay) {